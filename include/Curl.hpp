@@ -1,11 +1,194 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <curl/curl.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <VM/VM.hpp>
 
 namespace fer
 {
 
+struct CurlCallbackData;
+struct CurlAsyncState;
+class VarCurlSList;
+class VarCurlUrl;
+class VarCurlShare;
+class VarCurlMulti;
+class VarCurlRateLimit;
+class VarCurlCache;
+struct CurlCacheWrite;
+
+// Where the data received by a transfer is written to
+enum class CurlWriteMode
+{
+    FERAL_FN,    // the Feral write callback, if one is set
+    FILE_STREAM, // natively into a Feral file (VarFile), without calling into the VM
+    FILE_DESC,   // natively into a file descriptor, without calling into the VM
+    BUFFER,      // natively into an in-memory buffer, which is taken by the script after perform
+    JSON,        // natively into a JSON parser, whose result is taken by the script after perform
+};
+
+// How the last transfer of a handle with a cache (VarCurlCache) was served
+enum class CurlCacheStatus
+{
+    NONE,        // not through the cache (no cache, or not a GET request)
+    MISS,        // from the network, and stored if the response allows it
+    HIT,         // from the cache, without any request
+    REVALIDATED, // from the cache, after the server replied 304 Not Modified
+};
+
+// Decides when the Feral progress callback is called, since libcurl calls the C progress callback
+// at unpredictable (and often very high) rates
+struct CurlProgressThrottle
+{
+    std::chrono::steady_clock::time_point lastCall;
+    // minimum time and transferred bytes between two calls to the Feral callback
+    size_t intervalMs;
+    size_t intervalBytes;
+    // latest values (dlTotal, dlDone, ulTotal, ulDone) seen by the C callback
+    curl_off_t last[4];
+    // dlDone + ulDone at the last call to the Feral callback
+    curl_off_t lastCallBytes;
+    // whether `last` is yet to be passed to the Feral callback
+    bool pending;
+
+    CurlProgressThrottle();
+
+    // must be called before each transfer
+    void reset();
+    // records the values and returns true if the Feral callback must be called with them now
+    bool update(curl_off_t dlTotal, curl_off_t dlDone, curl_off_t ulTotal, curl_off_t ulDone);
+};
+
+// Where the data sent by a transfer (upload) is read from
+enum class CurlReadMode
+{
+    NONE,        // nothing is sent
+    FERAL_FN,    // the Feral read callback
+    FILE_STREAM, // natively from a Feral file (VarFile), without calling into the VM
+    FILE_DESC,   // natively from a file descriptor, without calling into the VM
+    MAPPED_FILE, // natively from a memory mapped file, without calling into the VM
+};
+
+// A read-only memory mapped file
+struct CurlMappedFile
+{
+    String path;
+    char *data;
+    size_t size;
+
+    CurlMappedFile();
+    // returns false on failure
+    bool open(const char *path);
+    void close();
+};
+
+enum class CurlJsonType : uint8_t
+{
+    NIL,
+    TRUE,
+    FALSE,
+    INT,
+    FLT,
+    STR,
+    ARR,
+    OBJ,
+};
+
+// A JSON value on the tape of CurlJsonParser - the elements of an array follow it, and so do the
+// key (STR) and value of each member of an object
+struct CurlJsonToken
+{
+    CurlJsonType type;
+    // ARR: number of elements, OBJ: number of members, STR: length in the string pool
+    size_t count;
+    union
+    {
+        int64_t i;
+        double f;
+        size_t off; // STR: offset in the string pool
+    };
+};
+
+// An incremental JSON parser, which is fed the chunks of a response body as they arrive (on any
+// thread), and records the values on a flat tape without involving the VM, which are turned into
+// Feral values once the transfer is done
+class CurlJsonParser
+{
+    enum class State : uint8_t
+    {
+        VALUE,            // a value is expected
+        ARR_VALUE_OR_END, // right after `[`
+        OBJ_KEY_OR_END,   // right after `{`
+        OBJ_KEY,          // right after `,` in an object
+        COLON,            // right after a key
+        AFTER_VALUE,      // a `,` or the end of the container (or of the input) is expected
+        STRING,
+        STRING_ESCAPE,    // right after `\`
+        STRING_UNICODE,   // in the 4 hex digits of `\u`
+        NUMBER,
+        LITERAL,          // true, false, or null
+        DONE,             // only whitespace can follow
+        FAILED,
+    };
+
+    Vector<CurlJsonToken> tape;
+    String strings;
+    // tape indices of the open arrays and objects
+    Vector<size_t> stack;
+    String error;
+    // the number or literal being read, which may be split across chunks
+    String scalar;
+    size_t consumed;        // bytes fed so far, for the error messages
+    uint32_t unicode;       // the code point being read in STRING_UNICODE
+    uint32_t highSurrogate; // the high half of a surrogate pair, waiting for the low half
+    uint8_t unicodeDigits;
+    bool inKey;
+    State state;
+
+    // pos is the position in the current chunk
+    bool fail(const char *msg, size_t pos);
+    bool startValue(char c, size_t pos);
+    void startString(bool key);
+    // records a finished value, and moves on to what can follow it
+    void endValue();
+    bool endContainer(char c, size_t pos);
+    void appendCodePoint(uint32_t cp);
+    void flushSurrogate();
+    bool endNumber(size_t pos);
+    Var *makeVar(VirtualMachine &vm, ModuleLoc loc, size_t &pos);
+
+public:
+    CurlJsonParser();
+
+    void reset();
+    // parses the next chunk of the input, returns false (and sets the error) if it is not valid
+    bool feed(const char *data, size_t len);
+    // must be called at the end of the input, returns false (and sets the error) if it is not a
+    // complete JSON value - which includes an empty input
+    bool finish();
+    // returns the parsed value, must be called after finish() succeeds
+    Var *toVar(VirtualMachine &vm, ModuleLoc loc);
+
+    inline const String &getError() { return error; }
+    inline bool isEmpty() { return tape.empty() && state == State::VALUE; }
+};
+
+// A string list option (such as CURLOPT_HTTPHEADER) of a handle - libcurl does not copy the lists,
+// so they must be kept until the option is replaced
+struct CurlSListOpt
+{
+    CURLoption opt;
+    // built by the handle from a map/vector/string, and freed by it
+    curl_slist *owned;
+    // prebuilt (VarCurlSList), referenced by the handle
+    VarCurlSList *shared;
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////// VarCurl //////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,18 +196,82 @@ namespace fer
 class VarCurl : public Var
 {
     CURL *val;
-    UniList<curl_mime *> mimelist; // list of mimes (for tracking memory)
-    UniList<curl_slist *> sllist;  // list of list of strings (for tracking memory)
+    curl_mime *mime;             // the active CURLOPT_MIMEPOST data, owned by this
+    Vector<CurlSListOpt> slists; // the active string list options, one per option
     VarFn *progCB;
     VarFn *writeCB;
+    VarFn *readCB;
+    VarFn *headerCB;
     // If this is not nullptr, it's guaranteed to have 5 elements which are reserved:
     // nullptr, dlTotal (float), dlDone (float), ulTotal (float), ulDone (float)
     VarVec *progCBArgs;
     // If this is not nullptr, it's guaranteed to have 2 elements which are reserved:
     // nullptr, dataToWrite (string)
     VarVec *writeCBArgs;
-    size_t progIntervalTick;
-    size_t progIntervalTickMax;
+    // If this is not nullptr, it's guaranteed to have 2 elements which are reserved:
+    // nullptr, maxBytesToRead (int)
+    VarVec *readCBArgs;
+    // If this is not nullptr, it's guaranteed to have 2 elements which are reserved:
+    // nullptr, headerLine (string)
+    VarVec *headerCBArgs;
+    // headers of the latest response, collected natively: lowercase name -> value
+    // the values of repeated headers are joined with ", "
+    StringMap<String> respHeaders;
+    // name of the last collected header, for folded (continuation) lines
+    String lastRespHeader;
+    // used when writeMode is FILE_STREAM
+    VarFile *writeFile;
+    // used when writeMode is FILE_DESC
+    int writeFd;
+    // used when writeMode is BUFFER
+    String writeBuf;
+    // used when writeMode is FERAL_FN - the received data is collected here until there are at
+    // least writeCoalesceBytes of it, and then passed to the Feral write callback in one call
+    String writeCoalesced;
+    size_t writeCoalesceBytes;
+    // used when writeMode is JSON
+    CurlJsonParser jsonParser;
+    CurlWriteMode writeMode;
+    // used when readMode is FILE_STREAM
+    VarFile *readFile;
+    // used when readMode is FILE_DESC
+    int readFd;
+    // used when readMode is MAPPED_FILE, readOffset being the position in it
+    CurlMappedFile readMap;
+    curl_off_t readOffset;
+    // data returned by the Feral read callback which did not fit in libcurl's buffer
+    String readPending;
+    size_t readPendingOffset;
+    CurlReadMode readMode;
+    // the share handle this is attached to (CURLOPT_SHARE), if any
+    VarCurlShare *share;
+    // the parsed URL this uses (CURLOPT_CURLU) instead of CURLOPT_URL, if any
+    VarCurlUrl *curlu;
+    // the handle whose HTTP/2 stream this one's depends on (CURLOPT_STREAM_DEPENDS(_E)), if any
+    VarCurl *streamDep;
+    CURLoption streamDepOpt;
+    // the token buckets shared with other handles, which cap the receive and send rates, if any
+    VarCurlRateLimit *recvLimit;
+    VarCurlRateLimit *sendLimit;
+    // the response cache used by perform(), if any
+    VarCurlCache *cache;
+    CurlCacheStatus cacheStatus;
+    // the URL and method of the request, as set by the options - libcurl does not expose them
+    // before the transfer, and the cache needs them for its key
+    String url;
+    String method;       // GET, POST, PUT, or HEAD, as per the options which change it
+    String customMethod; // CURLOPT_CUSTOMREQUEST, which overrides method
+    // whether CURLOPT_COOKIE is set, since the cache does not store responses to requests with
+    // credentials
+    bool cookieOpt;
+    // CURLOPT_NOPROGRESS as set by the options, since performAsync() enables the progress meter
+    // while it runs, to be able to abort the transfer at any time
+    bool noProgress;
+    CurlProgressThrottle progThrottle;
+    // set while a performAsync() transfer is running on this, which must not be touched meanwhile
+    bool asyncBusy;
+    // the multi handle this is in, if any - it holds the reference, so this one does not
+    VarCurlMulti *multi;
 
     void onCreate(VirtualMachine &vm) override;
     void onDestroy(VirtualMachine &vm) override;
@@ -37,21 +284,123 @@ public:
     void setProgressCB(VirtualMachine &vm, VarFn *_progCB, Span<Var *> args);
     // _writeCB can be nullptr, and args can have zero elements
     void setWriteCB(VirtualMachine &vm, VarFn *_writeCB, Span<Var *> args);
+    // switches the write mode to FILE_STREAM, or back to FERAL_FN if _writeFile is nullptr
+    void setWriteFile(VirtualMachine &vm, VarFile *_writeFile);
+    // switches the write mode to FILE_DESC
+    void setWriteFd(VirtualMachine &vm, int fd);
+    // switches the read mode to FERAL_FN (or NONE if _readCB is nullptr), args can have zero
+    // elements
+    void setReadCB(VirtualMachine &vm, VarFn *_readCB, Span<Var *> args);
+    // switches the read mode to FILE_STREAM, or NONE if _readFile is nullptr
+    void setReadFile(VirtualMachine &vm, VarFile *_readFile);
+    // switches the read mode to FILE_DESC
+    void setReadFd(VirtualMachine &vm, int fd);
+    // switches the read mode to MAPPED_FILE, and sets the upload size to the file's size
+    // returns false if the file could not be mapped
+    bool setReadMappedFile(VirtualMachine &vm, const char *path);
+    // fills buf with up to len bytes of the upload data, as per CURLOPT_READFUNCTION
+    size_t readUpload(CurlCallbackData &cbdata, char *buf, size_t len);
+    // moves the position in the upload data, as per CURLOPT_SEEKFUNCTION
+    int seekUpload(curl_off_t offset, int origin);
+    // _headerCB can be nullptr, and args can have zero elements
+    void setHeaderCB(VirtualMachine &vm, VarFn *_headerCB, Span<Var *> args);
+    // parses a header line of the response into respHeaders
+    void collectHeader(StringRef line);
+    // switches the write mode to BUFFER, or back to FERAL_FN if enabled is false
+    void setWriteBuffered(VirtualMachine &vm, bool enabled);
+    // switches the write mode to JSON, or back to FERAL_FN if enabled is false
+    void setWriteJson(VirtualMachine &vm, bool enabled);
+    // resets all the options of this (curl_easy_reset) and the Feral side state, but keeps the
+    // arg vectors, and the live connections, DNS cache, and TLS session cache of the handle
+    void reset(VirtualMachine &vm);
+    // _share can be nullptr, to detach from the current share handle
+    CURLcode setShare(VirtualMachine &vm, VarCurlShare *_share);
+    // _curlu can be nullptr, to go back to CURLOPT_URL
+    CURLcode setCurlUrl(VirtualMachine &vm, VarCurlUrl *_curlu);
+    // returns the URL of the next request - of curlu if it's set, else of CURLOPT_URL - or an
+    // empty string if there is none
+    String getRequestUrl();
+    // opt is CURLOPT_STREAM_DEPENDS or CURLOPT_STREAM_DEPENDS_E, _streamDep can be nullptr
+    CURLcode setStreamDep(VirtualMachine &vm, CURLoption opt, VarCurl *_streamDep);
+    // either can be nullptr, to not limit that direction
+    void setRateLimits(VirtualMachine &vm, VarCurlRateLimit *_recvLimit,
+                       VarCurlRateLimit *_sendLimit);
+    // _cache can be nullptr
+    void setCache(VirtualMachine &vm, VarCurlCache *_cache);
+    // records the URL, method, and progress meter state set by the option `opt`, once it is set
+    // to `arg`
+    void trackRequestOpt(int opt, Var *arg);
+    // returns the string list option `opt` (owned or shared), or nullptr if it is not set
+    curl_slist *getSList(CURLoption opt);
+    // creates a new handle with all the options (curl_easy_duphandle) and Feral side state of this,
+    // except the per transfer state (response headers, buffered body, upload position)
+    // returns nullptr on failure
+    VarCurl *clone(VirtualMachine &vm, ModuleLoc loc);
+    // appends data to writeBuf, growing it geometrically (or to the content length, if known,
+    // up to CURL_WRITE_BUF_MAX_RESERVE)
+    // returns false if it ran out of memory, which fails the transfer with CURLE_WRITE_ERROR
+    bool appendWriteBuf(const char *data, size_t len);
+    // passes data to the Feral write callback, or collects it for a later call if coalescing
+    // returns false if the callback failed
+    bool writeFeral(VirtualMachine &vm, ModuleLoc loc, StringRef data);
+    // passes the data collected by writeFeral() to the Feral write callback, if there is any
+    // returns false if the callback failed
+    bool flushFeralWrite(VirtualMachine &vm, ModuleLoc loc);
     // data can be either VarMap or VarStr: if it's VarStr, the string is used as filename
     curl_mime *createMime(VirtualMachine &vm, ModuleLoc loc, Var *data);
-    void clearMimeData();
-    curl_slist *createSList(VirtualMachine &vm, ModuleLoc loc, Var *data);
-    void clearSList();
+    // sets CURLOPT_MIMEPOST to _mime (can be nullptr) and frees the previous one
+    CURLcode setMime(curl_mime *_mime);
+    // sets the string list option `opt` to either owned or shared (both can be nullptr), and frees
+    // or releases the previous list of `opt`
+    CURLcode setSList(VirtualMachine &vm, CURLoption opt, curl_slist *owned, VarCurlSList *shared);
+    void clearSLists(VirtualMachine &vm);
+
+    inline void setProgInterval(size_t ms, size_t bytes)
+    {
+        progThrottle.intervalMs    = ms;
+        progThrottle.intervalBytes = bytes;
+    }
+    inline void setAsyncBusy(bool busy) { asyncBusy = busy; }
+    inline void setMulti(VarCurlMulti *_multi) { multi = _multi; }
+    // 0 calls the Feral write callback for each chunk received
+    inline void setWriteCoalesce(size_t bytes) { writeCoalesceBytes = bytes; }
+    inline void setCacheStatus(CurlCacheStatus status) { cacheStatus = status; }
 
-    inline void setProgIntervalTickMax(size_t maxVal) { progIntervalTickMax = maxVal; }
+    // must be called before each transfer - sets the userdata pointers passed to the C callbacks
+    // (progress, write) and resets the per transfer state
+    void prepareTransfer(CurlCallbackData *cbdata);
+    // must be called on the VM thread after each transfer - passes the remaining coalesced data to
+    // the Feral write callback, and makes the final call to the Feral progress callback, if the
+    // throttle held back the latest progress
+    // returns false if a Feral callback failed
+    bool finishTransfer(VirtualMachine &vm, ModuleLoc loc);
 
     inline CURL *const getVal() { return val; }
     inline VarFn *getProgressCB() { return progCB; }
     inline VarFn *getWriteCB() { return writeCB; }
+    inline CurlReadMode getReadMode() { return readMode; }
+    inline VarFn *getHeaderCB() { return headerCB; }
+    inline VarVec *getHeaderCBArgs() { return headerCBArgs; }
+    inline StringMap<String> &getRespHeaders() { return respHeaders; }
     inline VarVec *getProgressCBArgs() { return progCBArgs; }
     inline VarVec *getWriteCBArgs() { return writeCBArgs; }
-    inline size_t &getProgIntervalTick() { return progIntervalTick; }
-    inline size_t getProgIntervalTickMax() { return progIntervalTickMax; }
+    inline VarFile *getWriteFile() { return writeFile; }
+    inline int getWriteFd() { return writeFd; }
+    inline String &getWriteBuf() { return writeBuf; }
+    inline CurlWriteMode getWriteMode() { return writeMode; }
+    inline CurlJsonParser &getJsonParser() { return jsonParser; }
+    inline VarCurlShare *getShare() { return share; }
+    inline VarCurlUrl *getCurlUrl() { return curlu; }
+    inline VarCurlRateLimit *getRecvLimit() { return recvLimit; }
+    inline VarCurlRateLimit *getSendLimit() { return sendLimit; }
+    inline VarCurlCache *getCache() { return cache; }
+    inline CurlCacheStatus getCacheStatus() { return cacheStatus; }
+    inline const String &getMethod() { return customMethod.empty() ? method : customMethod; }
+    inline CurlProgressThrottle &getProgThrottle() { return progThrottle; }
+    inline bool isAsyncBusy() { return asyncBusy; }
+    inline bool isNoProgress() { return noProgress; }
+    inline bool hasCookieOpt() { return cookieOpt; }
+    inline VarCurlMulti *getMulti() { return multi; }
 };
 
 struct CurlCallbackData
@@ -59,7 +408,347 @@ struct CurlCallbackData
     ModuleLoc loc;
     VirtualMachine &vm;
     VarCurl *curl;
+    // if this is not nullptr, the callbacks are running on a worker thread (performAsync), and
+    // must queue the data for the Feral callbacks in here instead of calling into the VM
+    CurlAsyncState *async;
+    // if this is not nullptr, the transfer is driven by this multi handle, so the callbacks must
+    // not block (and pause the transfer instead)
+    VarCurlMulti *multi;
+    // if this is not nullptr, the response body is written to the store of a cache as well
+    CurlCacheWrite *cacheWrite;
     CurlCallbackData(ModuleLoc loc, VirtualMachine &vm, VarCurl *curl);
 };
 
+// State shared by a VarCurlFuture (on the VM thread) and the worker thread performing its transfer
+struct CurlAsyncState
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    CurlCallbackData cbdata;
+    // chunks received for the Feral write callback, to be passed to it on the VM thread
+    Vector<String> writeQueue;
+    size_t writeQueueBytes;
+    // latest progress values (dlTotal, dlDone, ulTotal, ulDone) for the Feral progress callback
+    curl_off_t progress[4];
+    bool progressPending;
+    // set by the VM thread to abort the transfer
+    std::atomic<bool> cancelled;
+    bool done;
+    CURLcode result;
+
+    CurlAsyncState(ModuleLoc loc, VirtualMachine &vm, VarCurl *curl);
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlFuture ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class VarCurlFuture : public Var
+{
+    VarCurl *curl;
+    std::shared_ptr<CurlAsyncState> state;
+    // set once the transfer is seen to be finished, and curl is usable again
+    bool released;
+
+    void onCreate(VirtualMachine &vm) override;
+    void onDestroy(VirtualMachine &vm) override;
+
+public:
+    VarCurlFuture(ModuleLoc loc, VarCurl *curl, std::shared_ptr<CurlAsyncState> state);
+
+    // Waits for up to timeoutMs (forever if negative) for the transfer to finish, passing the
+    // queued data to the Feral callbacks meanwhile.
+    // Returns false if a Feral callback failed, sets isDone when the transfer is finished.
+    bool wait(VirtualMachine &vm, ModuleLoc loc, int64_t timeoutMs, bool &isDone);
+
+    inline CURLcode getResult() { return state->result; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlSList ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A prebuilt (immutable) string list, which can be set as an option of any number of handles,
+// without being rebuilt for each of them
+class VarCurlSList : public Var
+{
+    curl_slist *val;
+
+public:
+    VarCurlSList(ModuleLoc loc, curl_slist *val);
+    ~VarCurlSList();
+
+    inline curl_slist *getVal() { return val; }
+};
+
+// data can be VarStr (a single item), VarVec (each element is an item), or VarMap (each key-value
+// pair is an item as `key: value`, as used by headers)
+// returns nullptr (after failing) if the list could not be created
+curl_slist *createSList(VirtualMachine &vm, ModuleLoc loc, Var *data);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// VarCurlUrl /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A parsed URL (CURLU), whose parts are read and changed without reparsing the rest of it, and
+// which is used by handles as is (CURLOPT_CURLU)
+class VarCurlUrl : public Var
+{
+    CURLU *val;
+
+public:
+    VarCurlUrl(ModuleLoc loc, CURLU *val);
+    ~VarCurlUrl();
+
+    inline CURLU *getVal() { return val; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// VarCurlPool ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class VarCurlPool : public Var
+{
+    std::mutex mtx;
+    // idle handles, reset and ready for reuse, each referenced by the pool
+    Vector<VarCurl *> idle;
+    size_t maxHandles;
+
+    void onDestroy(VirtualMachine &vm) override;
+
+public:
+    VarCurlPool(ModuleLoc loc, size_t maxHandles);
+
+    // returns an idle handle, handing the pool's reference to it over to the caller, or nullptr
+    // if there is none
+    VarCurl *acquire();
+    // resets curl and keeps it idle for reuse, unless the pool is full (curl is left untouched
+    // then)
+    void release(VirtualMachine &vm, VarCurl *curl);
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlShare ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class VarCurlShare : public Var
+{
+    CURLSH *val;
+    // one lock for each type of shared data, used by the lock/unlock callbacks since the handles
+    // attached to this may be performing on different threads
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+    // bit mask of the shared data types (1 << CURL_LOCK_DATA_*), which libcurl does not expose
+    uint32_t sharedData;
+
+public:
+    VarCurlShare(ModuleLoc loc, CURLSH *val);
+    ~VarCurlShare();
+
+    // shares (or unshares) the data type `data`, and records it on success
+    CURLSHcode setShared(curl_lock_data data, bool enabled);
+    // whether the connection pool is shared, which handles performing on different threads cannot
+    // do
+    bool sharesConnections();
+
+    inline CURLSH *getVal() { return val; }
+    inline std::mutex &getLock(curl_lock_data data) { return locks[data]; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////// VarCurlRateLimit //////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A token bucket which caps the total transfer rate of all the handles it is set on, in any thread
+// The bucket may go into debt by one chunk of data per transfer, which is then paid off by waiting,
+// so each handle gets its turn at about the same rate
+class VarCurlRateLimit : public Var
+{
+    std::mutex mtx;
+    std::chrono::steady_clock::time_point lastRefill;
+    double tokens; // in bytes
+    size_t bytesPerSec;
+    // max tokens, which is how much can be transferred at full speed after being idle
+    size_t burst;
+
+    void refill(std::chrono::steady_clock::time_point now);
+
+public:
+    VarCurlRateLimit(ModuleLoc loc, size_t bytesPerSec, size_t burst);
+
+    // burst is bytesPerSec / 10 (at least 16 KB) if 0
+    void setRate(size_t _bytesPerSec, size_t _burst);
+    // returns how long to wait before transferring more data, zero if it can be transferred now
+    std::chrono::steady_clock::duration getWait();
+    // takes `bytes` out of the bucket, once they are transferred
+    void take(size_t bytes);
+
+    inline size_t getRate() { return bytesPerSec; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlCache ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// SHA-256, which names the response bodies in the store of a VarCurlCache by their content
+class CurlSha256
+{
+    uint32_t state[8];
+    uint8_t block[64];
+    uint64_t length; // bytes hashed so far
+
+    void compress(const uint8_t *data);
+
+public:
+    CurlSha256();
+
+    void reset();
+    void update(const char *data, size_t len);
+    // returns the digest as 64 lowercase hex digits, and resets the hash
+    String hexDigest();
+};
+
+// A response body being written to a temporary file in the store of a VarCurlCache, while it is
+// received
+struct CurlCacheWrite
+{
+    String tmpPath;
+    CurlSha256 hash;
+    size_t size; // bytes written so far
+    int fd;
+    bool failed;
+
+    CurlCacheWrite();
+    ~CurlCacheWrite();
+
+    // creates the temporary file in `dir`, returns false on failure
+    bool open(const String &dir);
+    void write(const char *data, size_t len);
+    // closes the temporary file and returns the SHA-256 of its content, or an empty string if
+    // writing it failed (the file is kept until this is destroyed, unless it is moved away)
+    String close();
+};
+
+// What a VarCurlCache knows about the response to a request
+struct CurlCacheEntry
+{
+    String key;
+    String blob; // SHA-256 of the body, which is the name of its file in the store
+    // when the response was received or last revalidated, minus its Age, in seconds since epoch
+    int64_t storedAt;
+    // seconds after storedAt for which the response is fresh, and used without any request
+    int64_t maxAge;
+    // the values of the request headers named in the response's Vary, which must be the same for
+    // the response to be used
+    String vary;
+    StringMap<String> headers; // as in VarCurl::respHeaders
+};
+
+// An HTTP response cache in a directory, which can be set on any number of handles.
+// The bodies are stored by their SHA-256 in `<dir>/blobs` (so identical ones are stored once),
+// and the metadata of each request in `<dir>/meta`, named by the SHA-256 of the request's key.
+// Both are replaced atomically (by renaming), so the directory can be shared by processes.
+class VarCurlCache : public Var
+{
+    String dir;
+    // lowercase names of the request headers whose values are a part of the key
+    Vector<String> keyHeaders;
+    // the size of the stored bodies above which the store is pruned
+    size_t maxBytes;
+    // the size of the stored bodies as of the last prune(), plus the ones stored since
+    size_t storeBytes;
+
+    String makeKey(const String &url, curl_slist *reqHeaders);
+    // returns the values of the request headers named in the Vary of entry (CurlCacheEntry::vary)
+    String getVary(const CurlCacheEntry &entry, curl_slist *reqHeaders);
+    String getMetaPath(const String &key);
+    // reads the metadata file at path into entry, returns false if it is missing or invalid
+    bool readMeta(const String &path, CurlCacheEntry &entry);
+    bool load(const String &key, CurlCacheEntry &entry);
+    bool save(const CurlCacheEntry &entry);
+    // sets the freshness of entry from the headers of a response received now, returns false if
+    // the response must not be stored (no-store, private, Vary: *, or a request with credentials
+    // and a response which is not explicitly cacheable)
+    bool setFreshness(CurlCacheEntry &entry, int64_t now, bool credentials);
+    // passes the body of entry to the write mode of the handle, returns false if a Feral callback
+    // failed, and sets res if anything else did
+    bool deliver(CurlCallbackData &cbdata, CurlMappedFile &body, CURLcode &res);
+
+public:
+    VarCurlCache(ModuleLoc loc, StringRef dir, const Vector<String> &keyHeaders,
+                 size_t maxBytes);
+
+    // creates the directories of the cache and prunes it, returns false (with err set) on failure
+    bool init(String &err);
+    // removes the entries which have been stale for more than CURL_CACHE_MAX_STALE_SEC, then (if
+    // the bodies, with `incoming` more bytes, take more than maxBytes) the least recently stored
+    // ones down to 3/4 of maxBytes, and then the bodies and temporary files no longer used
+    void prune(size_t incoming = 0);
+    // performs the GET request of cbdata's handle for `url` through the cache, after
+    // prepareTransfer()
+    // returns false if a Feral callback failed, and sets res to the result of the transfer
+    bool perform(CurlCallbackData &cbdata, const String &url, CURLcode &res);
+
+    inline const String &getDir() { return dir; }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlMulti ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+class VarCurlMulti : public Var
+{
+    CURLM *val;
+    // callback data of each of the added easy handles (set as their CURLOPT_PRIVATE as well),
+    // the VarCurl in each of them holds a reference for as long as it is in the multi handle
+    Vector<CurlCallbackData *> handles;
+    // the sockets libcurl wants watched (CURLMOPT_SOCKETFUNCTION): socket -> CURL_POLL_*
+    std::unordered_map<curl_socket_t, int> sockets;
+    // when libcurl wants socketAction(CURL_SOCKET_TIMEOUT) called (CURLMOPT_TIMERFUNCTION)
+    std::chrono::steady_clock::time_point timerDeadline;
+    bool timerSet;
+    // running transfers, as of the last socketAction()
+    int running;
+    // epoll instance watching `sockets` (Linux), created by the first waitEvents()
+    int epollFd;
+    // handles paused by their rate limit, and when to resume them
+    Vector<std::pair<std::chrono::steady_clock::time_point, VarCurl *>> ratePaused;
+
+    void onDestroy(VirtualMachine &vm) override;
+
+public:
+    VarCurlMulti(ModuleLoc loc, CURLM *val);
+    ~VarCurlMulti();
+
+    // returns CURLM_ADDED_ALREADY, without touching `curl`, if it is in a multi handle already
+    CURLMcode addHandle(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl);
+    CURLMcode removeHandle(VirtualMachine &vm, VarCurl *curl);
+    // callbacks of the easy handles report errors at `loc` (the location of perform/poll call)
+    void setCallbackLoc(ModuleLoc loc);
+
+    // called by the socket and timer callbacks of the multi handle
+    void watchSocket(curl_socket_t sock, int what);
+    void setTimer(long timeoutMs);
+    // curl_multi_socket_action(), events being CURL_CSELECT_*
+    CURLMcode socketAction(curl_socket_t sock, int events);
+    // waits for up to timeoutMs (forever if negative) for activity on the watched sockets, or for
+    // the timer of libcurl, whichever is earlier, and services them with socketAction()
+    // errMsg is set if the wait itself failed
+    CURLMcode waitEvents(int timeoutMs, const char *&errMsg);
+    // milliseconds until libcurl wants socketAction(CURL_SOCKET_TIMEOUT) called (or until a
+    // handle paused by its rate limit must be resumed by it), -1 if never
+    long getTimeoutMs();
+    // called by the callbacks of `curl` when its rate limit requires it to wait, instead of
+    // blocking all the transfers of this
+    void pauseForRate(VarCurl *curl, std::chrono::steady_clock::duration wait);
+    // resumes the handles paused by their rate limit, whose wait is over
+    void resumeRateLimited();
+    // milliseconds until a handle paused by its rate limit must be resumed, -1 if none is paused
+    long getRateWaitMs();
+
+    inline CURLM *getVal() { return val; }
+    inline size_t getHandleCount() { return handles.size(); }
+    inline int getRunning() { return running; }
+    inline const std::unordered_map<curl_socket_t, int> &getSockets() { return sockets; }
+};
+
 } // namespace fer
\ No newline at end of file
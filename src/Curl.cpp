@@ -1,73 +1,899 @@
 #include "Curl.hpp"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <new>
+#include <thread>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
 namespace fer
 {
 
-constexpr size_t CURL_DEFAULT_PROGRESS_INTERVAL_TICK_MAX = 10;
+constexpr size_t CURL_DEFAULT_PROGRESS_INTERVAL_MS = 100;
+// max data queued for the Feral write callback by a performAsync() transfer, before the worker
+// thread waits for the VM thread to consume it
+constexpr size_t CURL_ASYNC_MAX_QUEUED_BYTES = 16 * 1024 * 1024;
+// max data passed to the write callback (or file) at a time, when a response comes from the cache
+constexpr size_t CURL_CACHE_DELIVER_CHUNK = 1024 * 1024;
+// cache entries which have been stale for longer are removed when the cache is pruned, as they are
+// unlikely to be revalidated
+constexpr int64_t CURL_CACHE_MAX_STALE_SEC = 7 * 24 * 60 * 60;
+// temporary cache files older than this are left over by a crashed process
+constexpr int64_t CURL_CACHE_TMP_MAX_AGE_SEC = 24 * 60 * 60;
+// max memory reserved up front for a buffered response as per its Content-Length, which the
+// server can get wrong - larger bodies grow geometrically as they are received
+constexpr size_t CURL_WRITE_BUF_MAX_RESERVE = 32 * 1024 * 1024;
 
 void setEnumVars(VirtualMachine &vm, ModuleLoc loc);
 
+//////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////// Statistics ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Log-linear (HDR style) histogram of microsecond latencies - values below 2^SUB_BITS have a bucket
+// each, above that, each power of two is split into 2^SUB_BITS buckets (~3% relative error).
+// All updates are relaxed atomics, so recording never takes a lock.
+class CurlLatencyHistogram
+{
+    static constexpr int SUB_BITS        = 5;
+    static constexpr uint64_t SUB_COUNT  = 1 << SUB_BITS;
+    static constexpr int MAX_BITS        = 40; // ~12.7 days in microseconds
+    static constexpr size_t BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min;
+    std::atomic<uint64_t> max;
+
+    static size_t bucketOf(uint64_t val)
+    {
+        if(val < SUB_COUNT) return val;
+        int msb = std::bit_width(val) - 1;
+        if(msb >= MAX_BITS) return BUCKET_COUNT - 1;
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((val >> shift) - SUB_COUNT);
+    }
+    // the highest value which falls in the bucket
+    static uint64_t valueOf(size_t bucket)
+    {
+        if(bucket < SUB_COUNT) return bucket;
+        int shift = bucket / SUB_COUNT - 1;
+        return (((bucket % SUB_COUNT) + SUB_COUNT + 1) << shift) - 1;
+    }
+
+public:
+    CurlLatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        for(auto &b : buckets) b.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(UINT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+    void record(curl_off_t us)
+    {
+        uint64_t val = us < 0 ? 0 : us;
+        buckets[bucketOf(val)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(val, std::memory_order_relaxed);
+        uint64_t cur = min.load(std::memory_order_relaxed);
+        while(val < cur && !min.compare_exchange_weak(cur, val, std::memory_order_relaxed)) {}
+        cur = max.load(std::memory_order_relaxed);
+        while(val > cur && !max.compare_exchange_weak(cur, val, std::memory_order_relaxed)) {}
+    }
+    // the value at or below which `percentile` percent of the recorded values are
+    uint64_t valueAt(double percentile) const
+    {
+        uint64_t total = count.load(std::memory_order_relaxed);
+        if(total == 0) return 0;
+        uint64_t target = std::max<uint64_t>(1, percentile / 100.0 * total + 0.5);
+        uint64_t seen   = 0;
+        for(size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if(seen >= target) return std::min(valueOf(i), max.load(std::memory_order_relaxed));
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+
+    VarMap *toMap(VirtualMachine &vm, ModuleLoc loc) const
+    {
+        uint64_t total = count.load(std::memory_order_relaxed);
+        uint64_t lo    = min.load(std::memory_order_relaxed);
+        VarMap *res    = vm.makeVar<VarMap>(loc, 9, false);
+        res->insert(vm, "count", vm.makeVar<VarInt>(loc, total), true);
+        res->insert(vm, "sum", vm.makeVar<VarInt>(loc, sum.load(std::memory_order_relaxed)),
+                    true);
+        res->insert(vm, "min", vm.makeVar<VarInt>(loc, total ? lo : 0), true);
+        res->insert(vm, "max", vm.makeVar<VarInt>(loc, max.load(std::memory_order_relaxed)),
+                    true);
+        res->insert(vm, "mean",
+                    vm.makeVar<VarFlt>(
+                        loc, total ? (double)sum.load(std::memory_order_relaxed) / total : 0.0),
+                    true);
+        res->insert(vm, "p50", vm.makeVar<VarInt>(loc, valueAt(50.0)), true);
+        res->insert(vm, "p90", vm.makeVar<VarInt>(loc, valueAt(90.0)), true);
+        res->insert(vm, "p99", vm.makeVar<VarInt>(loc, valueAt(99.0)), true);
+        res->insert(vm, "p999", vm.makeVar<VarInt>(loc, valueAt(99.9)), true);
+        return res;
+    }
+};
+
+// Process wide counters of all the transfers done by the module
+struct CurlStats
+{
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> errors[CURL_LAST];
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint64_t> connectionsNew;
+    std::atomic<uint64_t> connectionsReused;
+    CurlLatencyHistogram connectTime;
+    CurlLatencyHistogram firstByteTime;
+    CurlLatencyHistogram totalTime;
+
+    CurlStats() { reset(); }
+
+    void reset()
+    {
+        requests.store(0, std::memory_order_relaxed);
+        for(auto &e : errors) e.store(0, std::memory_order_relaxed);
+        bytesIn.store(0, std::memory_order_relaxed);
+        bytesOut.store(0, std::memory_order_relaxed);
+        connectionsNew.store(0, std::memory_order_relaxed);
+        connectionsReused.store(0, std::memory_order_relaxed);
+        connectTime.reset();
+        firstByteTime.reset();
+        totalTime.reset();
+    }
+};
+
+static CurlStats curlStats;
+
+// Records the finished transfer of `curl` in the module statistics, safe to call from any thread
+void recordTransferStats(CURL *curl, CURLcode result)
+{
+    curlStats.requests.fetch_add(1, std::memory_order_relaxed);
+    if(result > 0 && result < CURL_LAST) {
+        curlStats.errors[result].fetch_add(1, std::memory_order_relaxed);
+    }
+    // failed transfers are recorded as well, since their latencies (timeouts, for instance)
+    // matter the most
+    curl_off_t dl = 0, ul = 0, connect = 0, firstByte = 0, total = 0;
+    long headerSize = 0, requestSize = 0, connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &dl);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &ul);
+    curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &headerSize);
+    curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &requestSize);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curlStats.bytesIn.fetch_add(dl + headerSize, std::memory_order_relaxed);
+    curlStats.bytesOut.fetch_add(ul + requestSize, std::memory_order_relaxed);
+    // both count transfers - one which sent its request without having to connect reused a live
+    // connection, while one which failed before that used neither
+    if(connects > 0) {
+        curlStats.connectionsNew.fetch_add(1, std::memory_order_relaxed);
+        curlStats.connectTime.record(connect);
+    } else if(requestSize > 0) {
+        curlStats.connectionsReused.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(firstByte > 0) curlStats.firstByteTime.record(firstByte);
+    curlStats.totalTime.record(total);
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////// Callbacks ////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Calls the Feral progress callback of `curl`, returns false if it failed
+bool callFeralProgressCB(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl, curl_off_t dlTotal,
+                         curl_off_t dlDone, curl_off_t ulTotal, curl_off_t ulDone)
+{
+    VarVec *argsVar = curl->getProgressCBArgs();
+    as<VarFlt>(argsVar->at(1))->setVal(dlTotal);
+    as<VarFlt>(argsVar->at(2))->setVal(dlDone);
+    as<VarFlt>(argsVar->at(3))->setVal(ulTotal);
+    as<VarFlt>(argsVar->at(4))->setVal(ulDone);
+    if(!curl->getProgressCB()->call(vm, loc, argsVar->getVal(), nullptr)) {
+        vm.fail(loc, "failed to call progress callback, check error above");
+        return false;
+    }
+    return true;
+}
+
+// Calls the Feral write callback of `curl`, returns false if it failed
+bool callFeralWriteCB(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl, StringRef data)
+{
+    VarVec *argsVar = curl->getWriteCBArgs();
+    as<VarStr>(argsVar->at(1))->setVal(data);
+    if(!curl->getWriteCB()->call(vm, loc, argsVar->getVal(), nullptr)) {
+        vm.fail(loc, "failed to call write callback, check error above");
+        return false;
+    }
+    return true;
+}
+
 int curlProgressCallback(void *ptr, curl_off_t dlTotal, curl_off_t dlDone, curl_off_t ulTotal,
                          curl_off_t ulDone)
 {
+    CurlCallbackData &cbdata = *(CurlCallbackData *)ptr;
+
+    // this is the only callback called while connecting or while the server is stalled, so a
+    // cancelled performAsync() transfer is aborted here before anything else
+    if(cbdata.async && cbdata.async->cancelled) return 1;
+
     // ensure that the file to be downloaded is not empty
     // because that would cause a division by zero error later on
     if(dlTotal <= 0 && ulTotal <= 0) return 0;
 
-    CurlCallbackData &cbdata = *(CurlCallbackData *)ptr;
+    // performAsync() enables the progress meter regardless of CURLOPT_NOPROGRESS
+    if(!cbdata.curl->getProgressCB() || cbdata.curl->isNoProgress()) return 0;
 
-    if(!cbdata.curl->getProgressCB()) return 0;
+    if(!cbdata.curl->getProgThrottle().update(dlTotal, dlDone, ulTotal, ulDone)) {
+        return cbdata.async ? cbdata.async->cancelled.load() : 0;
+    }
 
-    size_t &intervalTick = cbdata.curl->getProgIntervalTick();
-    if(intervalTick < cbdata.curl->getProgIntervalTickMax()) {
-        ++intervalTick;
-        return 0;
+    if(cbdata.async) {
+        CurlAsyncState &state = *cbdata.async;
+        std::lock_guard<std::mutex> lock(state.mtx);
+        state.progress[0]     = dlTotal;
+        state.progress[1]     = dlDone;
+        state.progress[2]     = ulTotal;
+        state.progress[3]     = ulDone;
+        state.progressPending = true;
+        state.cv.notify_all();
+        return state.cancelled;
     }
-    intervalTick = 0;
+    return !callFeralProgressCB(cbdata.vm, cbdata.loc, cbdata.curl, dlTotal, dlDone, ulTotal,
+                                ulDone);
+}
 
-    VarVec *argsVar = cbdata.curl->getProgressCBArgs();
-    as<VarFlt>(argsVar->at(1))->setVal(dlTotal);
-    as<VarFlt>(argsVar->at(2))->setVal(dlDone);
-    as<VarFlt>(argsVar->at(3))->setVal(ulTotal);
-    as<VarFlt>(argsVar->at(4))->setVal(ulDone);
-    if(!cbdata.curl->getProgressCB()->call(cbdata.vm, cbdata.loc, argsVar->getVal(), nullptr)) {
-        cbdata.vm.fail(cbdata.loc, "failed to call progress callback, check error above");
-        return 1;
+// Writes all of `data` to `fd`, returns the number of bytes written (less than len on failure)
+size_t writeToFd(int fd, const char *data, size_t len)
+{
+    size_t done = 0;
+    while(done < len) {
+#if defined(_WIN32)
+        int res = _write(fd, data + done, len - done);
+#else
+        ssize_t res = write(fd, data + done, len - done);
+        if(res < 0 && errno == EINTR) continue;
+#endif
+        if(res <= 0) break;
+        done += res;
     }
-    return 0;
+    return done;
+}
+
+// Queues data for the Feral write callback of a performAsync() transfer, waiting for the VM
+// thread to catch up first if too much data is queued already
+size_t queueAsyncWrite(CurlAsyncState &state, const char *data, size_t len)
+{
+    std::unique_lock<std::mutex> lock(state.mtx);
+    state.cv.wait(lock, [&]() {
+        return state.cancelled || state.writeQueueBytes < CURL_ASYNC_MAX_QUEUED_BYTES;
+    });
+    if(state.cancelled) return 0;
+    state.writeQueue.emplace_back(data, len);
+    state.writeQueueBytes += len;
+    state.cv.notify_all();
+    return len;
+}
+
+// Waits until `limit` allows more data to be transferred - returns false if the transfer must be
+// paused instead, since it's driven by a multi handle whose other transfers would be blocked too
+bool waitForRate(CurlCallbackData &cbdata, VarCurlRateLimit &limit)
+{
+    auto wait = limit.getWait();
+    if(wait <= wait.zero()) return true;
+    if(cbdata.multi) {
+        cbdata.multi->pauseForRate(cbdata.curl, wait);
+        return false;
+    }
+    while(wait > wait.zero()) {
+        // a cancelled performAsync() transfer must not keep waiting
+        if(cbdata.async && cbdata.async->cancelled) return true;
+        std::this_thread::sleep_for(
+            std::min<std::chrono::steady_clock::duration>(wait, std::chrono::milliseconds(50)));
+        wait = limit.getWait();
+    }
+    return true;
+}
+
+// Writes response data (received, or from the cache) as per the write mode of the handle
+// Returns the number of bytes written, which is less than len on failure
+size_t writeResponse(CurlCallbackData &cbdata, const char *data, size_t len)
+{
+    switch(cbdata.curl->getWriteMode()) {
+    case CurlWriteMode::FILE_STREAM:
+        return fwrite(data, 1, len, cbdata.curl->getWriteFile()->getFile());
+    case CurlWriteMode::FILE_DESC: return writeToFd(cbdata.curl->getWriteFd(), data, len);
+    case CurlWriteMode::BUFFER: return cbdata.curl->appendWriteBuf(data, len) ? len : 0;
+    case CurlWriteMode::JSON:
+        // invalid JSON does not abort the transfer, the error is reported by takeJson()
+        cbdata.curl->getJsonParser().feed(data, len);
+        return len;
+    case CurlWriteMode::FERAL_FN: break;
+    }
+    if(!cbdata.curl->getWriteCB()) return len; // returning zero is an error
+
+    if(cbdata.async) return queueAsyncWrite(*cbdata.async, data, len);
+    if(!cbdata.curl->writeFeral(cbdata.vm, cbdata.loc, StringRef(data, len))) return 0;
+    return len;
 }
 
 size_t curlWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     CurlCallbackData &cbdata = *(CurlCallbackData *)userdata;
-    if(!cbdata.curl->getWriteCB()) return size * nmemb; // returning zero is an error
+    if(cbdata.async && cbdata.async->cancelled) return 0;
+    if(VarCurlRateLimit *limit = cbdata.curl->getRecvLimit()) {
+        // libcurl passes the same data again once the transfer is unpaused
+        if(!waitForRate(cbdata, *limit)) return CURL_WRITEFUNC_PAUSE;
+        limit->take(size * nmemb);
+    }
+    if(cbdata.cacheWrite) cbdata.cacheWrite->write(ptr, size * nmemb);
+    return writeResponse(cbdata, ptr, size * nmemb);
+}
+
+size_t curlHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    CurlCallbackData &cbdata = *(CurlCallbackData *)userdata;
+    if(cbdata.async && cbdata.async->cancelled) return 0;
+    StringRef line(buffer, size * nitems);
+    cbdata.curl->collectHeader(line);
+    // performAsync() does not allow a Feral header callback
+    if(!cbdata.curl->getHeaderCB() || cbdata.async) return size * nitems;
 
-    VarVec *argsVar = cbdata.curl->getWriteCBArgs();
-    as<VarStr>(argsVar->at(1))->setVal(StringRef(ptr, size * nmemb));
-    if(!cbdata.curl->getWriteCB()->call(cbdata.vm, cbdata.loc, argsVar->getVal(), nullptr)) {
-        cbdata.vm.fail(cbdata.loc, "failed to call write callback, check error above");
+    VarVec *argsVar = cbdata.curl->getHeaderCBArgs();
+    as<VarStr>(argsVar->at(1))->setVal(line);
+    if(!cbdata.curl->getHeaderCB()->call(cbdata.vm, cbdata.loc, argsVar->getVal(), nullptr)) {
+        cbdata.vm.fail(cbdata.loc, "failed to call header callback, check error above");
         return 0;
     }
-    return size * nmemb;
+    return size * nitems;
+}
+
+size_t curlReadCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    CurlCallbackData &cbdata = *(CurlCallbackData *)userdata;
+    if(cbdata.async && cbdata.async->cancelled) return CURL_READFUNC_ABORT;
+    VarCurlRateLimit *limit = cbdata.curl->getSendLimit();
+    if(limit && !waitForRate(cbdata, *limit)) return CURL_READFUNC_PAUSE;
+    size_t res = cbdata.curl->readUpload(cbdata, buffer, size * nitems);
+    if(limit && res <= size * nitems) limit->take(res);
+    return res;
+}
+
+int curlSeekCallback(void *userdata, curl_off_t offset, int origin)
+{
+    CurlCallbackData &cbdata = *(CurlCallbackData *)userdata;
+    return cbdata.curl->seekUpload(offset, origin);
+}
+
+// Installs the C callbacks on a new (or reset) easy handle
+void installEasyCallbacks(CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgressCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, curlReadCallback);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, curlSeekCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+}
+
+void curlShareLockCallback(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+{
+    ((VarCurlShare *)userptr)->getLock(data).lock();
+}
+
+void curlShareUnlockCallback(CURL *, curl_lock_data data, void *userptr)
+{
+    ((VarCurlShare *)userptr)->getLock(data).unlock();
+}
+
+int curlMultiSocketCallback(CURL *, curl_socket_t sock, int what, void *userp, void *)
+{
+    ((VarCurlMulti *)userp)->watchSocket(sock, what);
+    return 0;
+}
+
+int curlMultiTimerCallback(CURLM *, long timeoutMs, void *userp)
+{
+    ((VarCurlMulti *)userp)->setTimer(timeoutMs);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// JSON Parser ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// deeper nesting is rejected, since the Feral values are built recursively
+constexpr size_t CURL_JSON_MAX_DEPTH = 1024;
+
+// characters which end a run of plain characters in a string: `"`, `\`, and control characters
+constexpr auto jsonStringStops = []() {
+    std::array<bool, 256> res = {};
+    for(int i = 0; i < 0x20; ++i) res[i] = true;
+    res['"']  = true;
+    res['\\'] = true;
+    return res;
+}();
+
+inline bool isJsonSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+inline bool isJsonDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isJsonNumberChar(char c)
+{
+    return isJsonDigit(c) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+}
+inline int jsonHexDigit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+// checks the JSON number grammar, which is stricter than strtod()
+bool isJsonNumber(StringRef num)
+{
+    size_t p = 0, n = num.size();
+    auto digits = [&]() {
+        size_t start = p;
+        while(p < n && isJsonDigit(num[p])) ++p;
+        return p > start;
+    };
+    if(p < n && num[p] == '-') ++p;
+    if(p < n && num[p] == '0') ++p;
+    else if(!digits()) return false;
+    if(p < n && num[p] == '.') {
+        ++p;
+        if(!digits()) return false;
+    }
+    if(p < n && (num[p] == 'e' || num[p] == 'E')) {
+        ++p;
+        if(p < n && (num[p] == '+' || num[p] == '-')) ++p;
+        if(!digits()) return false;
+    }
+    return p == n;
+}
+
+CurlJsonParser::CurlJsonParser() { reset(); }
+
+void CurlJsonParser::reset()
+{
+    tape.clear();
+    strings.clear();
+    stack.clear();
+    error.clear();
+    scalar.clear();
+    consumed      = 0;
+    unicode       = 0;
+    highSurrogate = 0;
+    unicodeDigits = 0;
+    inKey         = false;
+    state         = State::VALUE;
+}
+
+bool CurlJsonParser::fail(const char *msg, size_t pos)
+{
+    error = String(msg) + " at byte " + std::to_string(consumed + pos);
+    state = State::FAILED;
+    return false;
+}
+
+bool CurlJsonParser::startValue(char c, size_t pos)
+{
+    CurlJsonToken tok = {};
+    switch(c) {
+    case '{':
+    case '[':
+        if(stack.size() >= CURL_JSON_MAX_DEPTH) return fail("JSON nested too deep", pos);
+        stack.push_back(tape.size());
+        tok.type = c == '{' ? CurlJsonType::OBJ : CurlJsonType::ARR;
+        tape.push_back(tok);
+        state = c == '{' ? State::OBJ_KEY_OR_END : State::ARR_VALUE_OR_END;
+        return true;
+    case '"': startString(false); return true;
+    case 't':
+    case 'f':
+    case 'n':
+        scalar.assign(1, c);
+        state = State::LITERAL;
+        return true;
+    }
+    if(c != '-' && !isJsonDigit(c)) return fail("unexpected character", pos);
+    scalar.assign(1, c);
+    state = State::NUMBER;
+    return true;
+}
+
+void CurlJsonParser::startString(bool key)
+{
+    CurlJsonToken tok = {};
+    tok.type          = CurlJsonType::STR;
+    tok.off           = strings.size();
+    tape.push_back(tok);
+    inKey = key;
+    state = State::STRING;
+}
+
+void CurlJsonParser::endValue()
+{
+    if(stack.empty()) {
+        state = State::DONE;
+        return;
+    }
+    ++tape[stack.back()].count;
+    state = State::AFTER_VALUE;
+}
+
+bool CurlJsonParser::endContainer(char c, size_t pos)
+{
+    if((c == '}') != (tape[stack.back()].type == CurlJsonType::OBJ)) {
+        return fail("mismatched end of array or object", pos);
+    }
+    stack.pop_back();
+    endValue();
+    return true;
+}
+
+void CurlJsonParser::appendCodePoint(uint32_t cp)
+{
+    if(cp < 0x80) {
+        strings.push_back(cp);
+    } else if(cp < 0x800) {
+        strings.push_back(0xC0 | (cp >> 6));
+        strings.push_back(0x80 | (cp & 0x3F));
+    } else if(cp < 0x10000) {
+        strings.push_back(0xE0 | (cp >> 12));
+        strings.push_back(0x80 | ((cp >> 6) & 0x3F));
+        strings.push_back(0x80 | (cp & 0x3F));
+    } else {
+        strings.push_back(0xF0 | (cp >> 18));
+        strings.push_back(0x80 | ((cp >> 12) & 0x3F));
+        strings.push_back(0x80 | ((cp >> 6) & 0x3F));
+        strings.push_back(0x80 | (cp & 0x3F));
+    }
+}
+
+void CurlJsonParser::flushSurrogate()
+{
+    if(!highSurrogate) return;
+    // a lone surrogate has no UTF-8 representation
+    highSurrogate = 0;
+    appendCodePoint(0xFFFD);
+}
+
+bool CurlJsonParser::endNumber(size_t pos)
+{
+    if(!isJsonNumber(scalar)) return fail("invalid number", pos);
+    CurlJsonToken tok = {};
+    bool isInt        = scalar.find_first_of(".eE") == String::npos;
+    if(isInt) {
+        errno    = 0;
+        tok.type = CurlJsonType::INT;
+        tok.i    = strtoll(scalar.c_str(), nullptr, 10);
+        // integers which do not fit are kept as floats, like other JSON decoders do
+        isInt = errno != ERANGE;
+    }
+    if(!isInt) {
+        tok.type = CurlJsonType::FLT;
+        tok.f    = strtod(scalar.c_str(), nullptr);
+    }
+    tape.push_back(tok);
+    scalar.clear();
+    endValue();
+    return true;
+}
+
+bool CurlJsonParser::feed(const char *data, size_t len)
+{
+    for(size_t i = 0; i < len; ++i) {
+        char c = data[i];
+        switch(state) {
+        case State::VALUE:
+            if(!isJsonSpace(c) && !startValue(c, i)) return false;
+            break;
+        case State::ARR_VALUE_OR_END:
+            if(c == ']') {
+                if(!endContainer(c, i)) return false;
+                break;
+            }
+            if(!isJsonSpace(c) && !startValue(c, i)) return false;
+            break;
+        case State::OBJ_KEY_OR_END:
+            if(c == '}') {
+                if(!endContainer(c, i)) return false;
+                break;
+            }
+            // fallthrough
+        case State::OBJ_KEY:
+            if(isJsonSpace(c)) break;
+            if(c != '"') return fail("expected a string key", i);
+            startString(true);
+            break;
+        case State::COLON:
+            if(isJsonSpace(c)) break;
+            if(c != ':') return fail("expected ':'", i);
+            state = State::VALUE;
+            break;
+        case State::AFTER_VALUE:
+            if(isJsonSpace(c)) break;
+            if(c == ',') {
+                bool inObj = tape[stack.back()].type == CurlJsonType::OBJ;
+                state      = inObj ? State::OBJ_KEY : State::VALUE;
+            } else if(c == ']' || c == '}') {
+                if(!endContainer(c, i)) return false;
+            } else {
+                return fail("expected ',' or the end of array or object", i);
+            }
+            break;
+        case State::STRING: {
+            // the plain characters are copied in runs
+            size_t start = i;
+            while(i < len && !jsonStringStops[(unsigned char)data[i]]) ++i;
+            if(i > start) {
+                flushSurrogate();
+                strings.append(data + start, i - start);
+            }
+            if(i == len) break;
+            if(data[i] == '"') {
+                flushSurrogate();
+                tape.back().count = strings.size() - tape.back().off;
+                if(inKey) state = State::COLON;
+                else endValue();
+            } else if(data[i] == '\\') {
+                state = State::STRING_ESCAPE;
+            } else {
+                return fail("control character in string", i);
+            }
+            break;
+        }
+        case State::STRING_ESCAPE: {
+            char esc = 0;
+            switch(c) {
+            case '"': esc = '"'; break;
+            case '\\': esc = '\\'; break;
+            case '/': esc = '/'; break;
+            case 'b': esc = '\b'; break;
+            case 'f': esc = '\f'; break;
+            case 'n': esc = '\n'; break;
+            case 'r': esc = '\r'; break;
+            case 't': esc = '\t'; break;
+            case 'u': break;
+            default: return fail("invalid escape in string", i);
+            }
+            if(c == 'u') {
+                unicode       = 0;
+                unicodeDigits = 0;
+                state         = State::STRING_UNICODE;
+                break;
+            }
+            flushSurrogate();
+            strings.push_back(esc);
+            state = State::STRING;
+            break;
+        }
+        case State::STRING_UNICODE: {
+            int digit = jsonHexDigit(c);
+            if(digit < 0) return fail("invalid unicode escape in string", i);
+            unicode = unicode << 4 | digit;
+            if(++unicodeDigits < 4) break;
+            state = State::STRING;
+            if(unicode >= 0xD800 && unicode <= 0xDBFF) {
+                flushSurrogate();
+                highSurrogate = unicode;
+            } else if(unicode >= 0xDC00 && unicode <= 0xDFFF && highSurrogate) {
+                appendCodePoint(0x10000 + ((highSurrogate - 0xD800) << 10) + (unicode - 0xDC00));
+                highSurrogate = 0;
+            } else {
+                flushSurrogate();
+                bool lone = unicode >= 0xDC00 && unicode <= 0xDFFF;
+                appendCodePoint(lone ? 0xFFFD : unicode);
+            }
+            break;
+        }
+        case State::NUMBER: {
+            size_t start = i;
+            while(i < len && isJsonNumberChar(data[i])) ++i;
+            scalar.append(data + start, i - start);
+            if(i == len) break;
+            if(!endNumber(i)) return false;
+            // the character after the number is handled in the new state (i wraps around if 0)
+            --i;
+            break;
+        }
+        case State::LITERAL: {
+            const char *lit = scalar[0] == 't' ? "true" : scalar[0] == 'f' ? "false" : "null";
+            if(c != lit[scalar.size()]) return fail("invalid literal", i);
+            scalar.push_back(c);
+            if(lit[scalar.size()] != '\0') break;
+            CurlJsonToken tok = {};
+            tok.type          = scalar[0] == 't'   ? CurlJsonType::TRUE
+                                : scalar[0] == 'f' ? CurlJsonType::FALSE
+                                                   : CurlJsonType::NIL;
+            tape.push_back(tok);
+            scalar.clear();
+            endValue();
+            break;
+        }
+        case State::DONE:
+            if(!isJsonSpace(c)) return fail("unexpected data after the JSON value", i);
+            break;
+        case State::FAILED: return false;
+        }
+    }
+    consumed += len;
+    return true;
+}
+
+bool CurlJsonParser::finish()
+{
+    if(state == State::FAILED) return false;
+    if(state == State::NUMBER && !endNumber(0)) return false;
+    if(state == State::DONE) return true;
+    // RFC 8259 has no empty JSON text, bodiless responses are handled by the caller
+    if(isEmpty()) return fail("empty JSON body", 0);
+    return fail("unexpected end of JSON", 0);
+}
+
+Var *CurlJsonParser::makeVar(VirtualMachine &vm, ModuleLoc loc, size_t &pos)
+{
+    const CurlJsonToken &tok = tape[pos++];
+    switch(tok.type) {
+    case CurlJsonType::NIL: break;
+    case CurlJsonType::TRUE: return vm.makeVar<VarBool>(loc, true);
+    case CurlJsonType::FALSE: return vm.makeVar<VarBool>(loc, false);
+    case CurlJsonType::INT: return vm.makeVar<VarInt>(loc, tok.i);
+    case CurlJsonType::FLT: return vm.makeVar<VarFlt>(loc, tok.f);
+    case CurlJsonType::STR:
+        return vm.makeVar<VarStr>(loc, StringRef(strings.data() + tok.off, tok.count));
+    case CurlJsonType::ARR: {
+        VarVec *res = vm.makeVar<VarVec>(loc, tok.count, false);
+        for(size_t i = 0; i < tok.count; ++i) res->push(vm, makeVar(vm, loc, pos), true);
+        return res;
+    }
+    case CurlJsonType::OBJ: {
+        VarMap *res = vm.makeVar<VarMap>(loc, tok.count, false);
+        for(size_t i = 0; i < tok.count; ++i) {
+            const CurlJsonToken &key = tape[pos++];
+            StringRef name(strings.data() + key.off, key.count);
+            res->insert(vm, name, makeVar(vm, loc, pos), true);
+        }
+        return res;
+    }
+    }
+    return vm.getNil();
+}
+
+Var *CurlJsonParser::toVar(VirtualMachine &vm, ModuleLoc loc)
+{
+    if(tape.empty()) return vm.getNil();
+    size_t pos = 0;
+    return makeVar(vm, loc, pos);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////// VarCurl //////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////
 
+CurlMappedFile::CurlMappedFile() : data(nullptr), size(0) {}
+
+bool CurlMappedFile::open(const char *path)
+{
+    close();
+#if defined(_WIN32)
+    return false;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0) return false;
+    this->path = path;
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if(size > 0) {
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return false;
+        }
+        data = (char *)mapped;
+        // the whole file is read once, in order
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    // the mapping stays valid after the file is closed
+    ::close(fd);
+    return true;
+#endif
+}
+void CurlMappedFile::close()
+{
+#if !defined(_WIN32)
+    if(data) munmap(data, size);
+#endif
+    path.clear();
+    data = nullptr;
+    size = 0;
+}
+
+CurlProgressThrottle::CurlProgressThrottle()
+    : intervalMs(CURL_DEFAULT_PROGRESS_INTERVAL_MS), intervalBytes(0)
+{
+    reset();
+}
+
+void CurlProgressThrottle::reset()
+{
+    lastCall      = {};
+    lastCallBytes = 0;
+    pending       = false;
+    std::fill(last, last + 4, 0);
+}
+
+bool CurlProgressThrottle::update(curl_off_t dlTotal, curl_off_t dlDone, curl_off_t ulTotal,
+                                  curl_off_t ulDone)
+{
+    if(!pending && last[0] == dlTotal && last[1] == dlDone && last[2] == ulTotal &&
+       last[3] == ulDone)
+    {
+        return false;
+    }
+    last[0] = dlTotal;
+    last[1] = dlDone;
+    last[2] = ulTotal;
+    last[3] = ulDone;
+    pending = true;
+
+    auto now = std::chrono::steady_clock::now();
+    if(now - lastCall < std::chrono::milliseconds(intervalMs)) return false;
+    if(dlDone + ulDone - lastCallBytes < (curl_off_t)intervalBytes) return false;
+    lastCall      = now;
+    lastCallBytes = dlDone + ulDone;
+    pending       = false;
+    return true;
+}
+
 VarCurl::VarCurl(ModuleLoc loc, CURL *val)
-    : Var(loc, 0), val(val), progCB(nullptr), writeCB(nullptr), progCBArgs(nullptr),
-      writeCBArgs(nullptr), progIntervalTick(0),
-      progIntervalTickMax(CURL_DEFAULT_PROGRESS_INTERVAL_TICK_MAX)
+    : Var(loc, 0), val(val), mime(nullptr), progCB(nullptr), writeCB(nullptr), readCB(nullptr),
+      headerCB(nullptr), progCBArgs(nullptr), writeCBArgs(nullptr), readCBArgs(nullptr),
+      headerCBArgs(nullptr), writeFile(nullptr), writeFd(-1), writeCoalesceBytes(0),
+      writeMode(CurlWriteMode::FERAL_FN), readFile(nullptr), readFd(-1),
+      readOffset(0), readPendingOffset(0), readMode(CurlReadMode::NONE), share(nullptr),
+      curlu(nullptr), streamDep(nullptr), streamDepOpt(CURLOPT_STREAM_DEPENDS), recvLimit(nullptr),
+      sendLimit(nullptr), cache(nullptr), cacheStatus(CurlCacheStatus::NONE), method("GET"),
+      cookieOpt(false), noProgress(true), asyncBusy(false), multi(nullptr)
 {}
 VarCurl::~VarCurl()
 {
-    clearMimeData();
     curl_easy_cleanup(val);
+    if(mime) curl_mime_free(mime);
 }
 
 void VarCurl::onCreate(VirtualMachine &vm)
@@ -82,13 +908,32 @@ void VarCurl::onCreate(VirtualMachine &vm)
     writeCBArgs = vm.makeVar<VarVec>({}, 2, true);
     writeCBArgs->push(vm, nullptr, false);
     writeCBArgs->push(vm, vm.makeVar<VarStr>(getLoc(), ""), true);
+
+    readCBArgs = vm.makeVar<VarVec>(getLoc(), 2, true);
+    readCBArgs->push(vm, nullptr, false);
+    readCBArgs->push(vm, vm.makeVar<VarInt>(getLoc(), 0), true);
+
+    headerCBArgs = vm.makeVar<VarVec>(getLoc(), 2, true);
+    headerCBArgs->push(vm, nullptr, false);
+    headerCBArgs->push(vm, vm.makeVar<VarStr>(getLoc(), ""), true);
 }
 void VarCurl::onDestroy(VirtualMachine &vm)
 {
+    vm.decVarRef(headerCBArgs);
+    vm.decVarRef(readCBArgs);
     vm.decVarRef(writeCBArgs);
     vm.decVarRef(progCBArgs);
     setProgressCB(vm, nullptr, {});
     setWriteCB(vm, nullptr, {});
+    setWriteFile(vm, nullptr);
+    setReadCB(vm, nullptr, {});
+    // must be detached before the share handle can be cleaned up
+    setShare(vm, nullptr);
+    setCurlUrl(vm, nullptr);
+    setStreamDep(vm, CURLOPT_STREAM_DEPENDS, nullptr);
+    setRateLimits(vm, nullptr, nullptr);
+    setCache(vm, nullptr);
+    clearSLists(vm);
 }
 
 void VarCurl::setProgressCB(VirtualMachine &vm, VarFn *_progCB, Span<Var *> args)
@@ -106,164 +951,3770 @@ void VarCurl::setWriteCB(VirtualMachine &vm, VarFn *_writeCB, Span<Var *> args)
     writeCB = _writeCB;
     if(writeCB) vm.incVarRef(writeCB);
     if(!writeCBArgs) return;
-    while(writeCBArgs->size() > 5) { writeCBArgs->pop(vm, true); }
+    // only the 2 leading arguments (the slot for the Curl and the data) are fixed, all the others
+    // belong to the previous callback
+    while(writeCBArgs->size() > 2) { writeCBArgs->pop(vm, true); }
     for(auto &arg : args) { writeCBArgs->push(vm, arg, true); }
 }
+void VarCurl::setWriteFile(VirtualMachine &vm, VarFile *_writeFile)
+{
+    if(writeFile) vm.decVarRef(writeFile);
+    writeFile = _writeFile;
+    if(writeFile) vm.incVarRef(writeFile);
+    writeMode = writeFile ? CurlWriteMode::FILE_STREAM : CurlWriteMode::FERAL_FN;
+}
+void VarCurl::setWriteFd(VirtualMachine &vm, int fd)
+{
+    setWriteFile(vm, nullptr);
+    writeFd   = fd;
+    writeMode = CurlWriteMode::FILE_DESC;
+}
+
+curl_mime *VarCurl::createMime(VirtualMachine &vm, ModuleLoc loc, Var *data)
+{
+    if(data->is<VarMap>() && as<VarMap>(data)->getVal().empty()) return nullptr;
+
+    curl_mime *mime = curl_mime_init(val);
+    if(data->is<VarStr>()) {
+        curl_mimepart *part = curl_mime_addpart(mime);
+        curl_mime_filedata(part, as<VarStr>(data)->getVal().c_str());
+        curl_mime_filename(part, as<VarStr>(data)->getVal().c_str());
+    } else {
+        VarMap *map = as<VarMap>(data);
+        for(auto &item : map->getVal()) {
+            Var *v = nullptr;
+            Array<Var *, 1> tmp{item.second};
+            if(!vm.callVarAndExpect<VarStr>(loc, "str", v, tmp, {})) {
+                curl_mime_free(mime);
+                return nullptr;
+            }
+            const String &str   = as<VarStr>(v)->getVal();
+            curl_mimepart *part = curl_mime_addpart(mime);
+            curl_mime_name(part, item.first.c_str());
+            curl_mime_data(part, str.c_str(), str.size());
+            vm.decVarRef(v);
+        }
+    }
+    return mime;
+}
+CURLcode VarCurl::setMime(curl_mime *_mime)
+{
+    CURLcode res = curl_easy_setopt(val, CURLOPT_MIMEPOST, _mime);
+    if(mime) curl_mime_free(mime);
+    mime = _mime;
+    return res;
+}
+
+CURLcode VarCurl::setSList(VirtualMachine &vm, CURLoption opt, curl_slist *owned,
+                           VarCurlSList *shared)
+{
+    curl_slist *lst = owned ? owned : (shared ? shared->getVal() : nullptr);
+    CURLcode res    = curl_easy_setopt(val, opt, lst);
+    if(shared) vm.incVarRef(shared);
+    for(auto it = slists.begin(); it != slists.end(); ++it) {
+        if(it->opt != opt) continue;
+        if(it->owned) curl_slist_free_all(it->owned);
+        if(it->shared) vm.decVarRef(it->shared);
+        slists.erase(it);
+        break;
+    }
+    if(lst) slists.push_back({opt, owned, shared});
+    return res;
+}
+curl_slist *VarCurl::getSList(CURLoption opt)
+{
+    for(auto &sl : slists) {
+        if(sl.opt == opt) return sl.owned ? sl.owned : sl.shared->getVal();
+    }
+    return nullptr;
+}
+void VarCurl::clearSLists(VirtualMachine &vm)
+{
+    while(!slists.empty()) setSList(vm, slists.back().opt, nullptr, nullptr);
+}
+
+void VarCurl::setHeaderCB(VirtualMachine &vm, VarFn *_headerCB, Span<Var *> args)
+{
+    if(headerCB) vm.decVarRef(headerCB);
+    headerCB = _headerCB;
+    if(headerCB) vm.incVarRef(headerCB);
+    if(!headerCBArgs) return;
+    while(headerCBArgs->size() > 2) { headerCBArgs->pop(vm, true); }
+    for(auto &arg : args) { headerCBArgs->push(vm, arg, true); }
+}
+void VarCurl::collectHeader(StringRef line)
+{
+    while(!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.remove_suffix(1);
+    if(line.empty()) return; // end of headers
+    // status line of a new response (after a redirect, 100 Continue, etc.)
+    if(line.starts_with("HTTP/")) {
+        respHeaders.clear();
+        lastRespHeader.clear();
+        return;
+    }
+    auto trim = [](StringRef s) {
+        while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    };
+    if(line.front() == ' ' || line.front() == '\t') {
+        // obsolete line folding - continues the value of the previous header
+        auto it = respHeaders.find(lastRespHeader);
+        if(it == respHeaders.end()) return;
+        it->second += ' ';
+        it->second += trim(line);
+        return;
+    }
+    size_t colon = line.find(':');
+    if(colon == StringRef::npos) return;
+    StringRef name  = trim(line.substr(0, colon));
+    StringRef value = trim(line.substr(colon + 1));
+    lastRespHeader.assign(name);
+    for(auto &c : lastRespHeader) c = std::tolower((unsigned char)c);
+    auto it = respHeaders.find(lastRespHeader);
+    if(it == respHeaders.end()) {
+        respHeaders.emplace(lastRespHeader, value);
+        return;
+    }
+    it->second += ", ";
+    it->second += value;
+}
+
+void VarCurl::setReadCB(VirtualMachine &vm, VarFn *_readCB, Span<Var *> args)
+{
+    setReadFile(vm, nullptr);
+    if(readCB) vm.decVarRef(readCB);
+    readCB = _readCB;
+    if(readCB) vm.incVarRef(readCB);
+    readMode = readCB ? CurlReadMode::FERAL_FN : CurlReadMode::NONE;
+    if(!readCBArgs) return;
+    while(readCBArgs->size() > 2) { readCBArgs->pop(vm, true); }
+    for(auto &arg : args) { readCBArgs->push(vm, arg, true); }
+}
+void VarCurl::setReadFile(VirtualMachine &vm, VarFile *_readFile)
+{
+    if(readFile) vm.decVarRef(readFile);
+    readFile = _readFile;
+    if(readFile) vm.incVarRef(readFile);
+    readMap.close();
+    readMode = readFile ? CurlReadMode::FILE_STREAM : CurlReadMode::NONE;
+}
+void VarCurl::setReadFd(VirtualMachine &vm, int fd)
+{
+    setReadFile(vm, nullptr);
+    readFd   = fd;
+    readMode = CurlReadMode::FILE_DESC;
+}
+bool VarCurl::setReadMappedFile(VirtualMachine &vm, const char *path)
+{
+    setReadFile(vm, nullptr);
+    if(!readMap.open(path)) return false;
+    readMode = CurlReadMode::MAPPED_FILE;
+    curl_easy_setopt(val, CURLOPT_INFILESIZE_LARGE, (curl_off_t)readMap.size);
+    return true;
+}
+
+size_t VarCurl::readUpload(CurlCallbackData &cbdata, char *buf, size_t len)
+{
+    switch(readMode) {
+    case CurlReadMode::NONE: return 0;
+    case CurlReadMode::FILE_STREAM: {
+        size_t res = fread(buf, 1, len, readFile->getFile());
+        if(res == 0 && ferror(readFile->getFile())) return CURL_READFUNC_ABORT;
+        return res;
+    }
+    case CurlReadMode::FILE_DESC: {
+        while(true) {
+#if defined(_WIN32)
+            int res = _read(readFd, buf, len);
+#else
+            ssize_t res = read(readFd, buf, len);
+            if(res < 0 && errno == EINTR) continue;
+#endif
+            return res < 0 ? CURL_READFUNC_ABORT : res;
+        }
+    }
+    case CurlReadMode::MAPPED_FILE: {
+        size_t count = std::min(len, (size_t)(readMap.size - readOffset));
+        memcpy(buf, readMap.data + readOffset, count);
+        readOffset += count;
+        return count;
+    }
+    case CurlReadMode::FERAL_FN: break;
+    }
+    if(readPendingOffset >= readPending.size()) {
+        // Feral read callback: fn(maxBytes, args...) -> Str (empty when there is no more data)
+        as<VarInt>(readCBArgs->at(1))->setVal(len);
+        Var *ret = readCB->call(cbdata.vm, cbdata.loc, readCBArgs->getVal(), nullptr);
+        if(!ret) {
+            cbdata.vm.fail(cbdata.loc, "failed to call read callback, check error above");
+            return CURL_READFUNC_ABORT;
+        }
+        if(!ret->is<VarStr>()) {
+            cbdata.vm.fail(cbdata.loc, "expected read callback to return a string");
+            cbdata.vm.decVarRef(ret);
+            return CURL_READFUNC_ABORT;
+        }
+        readPending.assign(as<VarStr>(ret)->getVal());
+        readPendingOffset = 0;
+        cbdata.vm.decVarRef(ret);
+    }
+    // the callback may return more than len bytes, the rest is kept for the next call
+    size_t count = std::min(len, readPending.size() - readPendingOffset);
+    memcpy(buf, readPending.data() + readPendingOffset, count);
+    readPendingOffset += count;
+    return count;
+}
+int VarCurl::seekUpload(curl_off_t offset, int origin)
+{
+    switch(readMode) {
+    case CurlReadMode::FILE_STREAM:
+#if defined(_WIN32)
+        return _fseeki64(readFile->getFile(), offset, origin) ? CURL_SEEKFUNC_FAIL
+                                                               : CURL_SEEKFUNC_OK;
+#else
+        return fseeko(readFile->getFile(), offset, origin) ? CURL_SEEKFUNC_FAIL
+                                                            : CURL_SEEKFUNC_OK;
+#endif
+    case CurlReadMode::FILE_DESC:
+#if defined(_WIN32)
+        return _lseeki64(readFd, offset, origin) < 0 ? CURL_SEEKFUNC_FAIL : CURL_SEEKFUNC_OK;
+#else
+        return lseek(readFd, offset, origin) < 0 ? CURL_SEEKFUNC_FAIL : CURL_SEEKFUNC_OK;
+#endif
+    case CurlReadMode::MAPPED_FILE: {
+        if(origin == SEEK_CUR) offset += readOffset;
+        else if(origin == SEEK_END) offset += readMap.size;
+        if(offset < 0 || offset > (curl_off_t)readMap.size) return CURL_SEEKFUNC_FAIL;
+        readOffset = offset;
+        return CURL_SEEKFUNC_OK;
+    }
+    case CurlReadMode::NONE: return offset == 0 ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
+    case CurlReadMode::FERAL_FN: break;
+    }
+    return CURL_SEEKFUNC_CANTSEEK;
+}
+
+void VarCurl::setWriteBuffered(VirtualMachine &vm, bool enabled)
+{
+    setWriteFile(vm, nullptr);
+    if(enabled) writeMode = CurlWriteMode::BUFFER;
+    else writeBuf = String();
+}
+void VarCurl::setWriteJson(VirtualMachine &vm, bool enabled)
+{
+    setWriteFile(vm, nullptr);
+    if(enabled) writeMode = CurlWriteMode::JSON;
+    jsonParser.reset();
+}
+void VarCurl::reset(VirtualMachine &vm)
+{
+    curl_easy_reset(val);
+    installEasyCallbacks(val);
+    setProgressCB(vm, nullptr, {});
+    setWriteCB(vm, nullptr, {});
+    setWriteFile(vm, nullptr);
+    writeBuf       = String();
+    writeCoalesced = String();
+    setWriteCoalesce(0);
+    jsonParser.reset();
+    setReadCB(vm, nullptr, {});
+    setHeaderCB(vm, nullptr, {});
+    respHeaders.clear();
+    setShare(vm, nullptr);
+    setCurlUrl(vm, nullptr);
+    setStreamDep(vm, CURLOPT_STREAM_DEPENDS, nullptr);
+    setRateLimits(vm, nullptr, nullptr);
+    setCache(vm, nullptr);
+    cacheStatus = CurlCacheStatus::NONE;
+    url.clear();
+    method = "GET";
+    customMethod.clear();
+    cookieOpt  = false;
+    noProgress = true;
+    setMime(nullptr);
+    clearSLists(vm);
+    progThrottle = CurlProgressThrottle();
+}
+CURLcode VarCurl::setShare(VirtualMachine &vm, VarCurlShare *_share)
+{
+    CURLcode res = curl_easy_setopt(val, CURLOPT_SHARE, _share ? _share->getVal() : nullptr);
+    if(res != CURLE_OK) return res;
+    if(share) vm.decVarRef(share);
+    share = _share;
+    if(share) vm.incVarRef(share);
+    return res;
+}
+CURLcode VarCurl::setCurlUrl(VirtualMachine &vm, VarCurlUrl *_curlu)
+{
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    // libcurl uses the CURLU as is (copying it at the start of each transfer), so it must be kept
+    // alive for as long as it is set
+    CURLcode res = curl_easy_setopt(val, CURLOPT_CURLU, _curlu ? _curlu->getVal() : nullptr);
+    if(res != CURLE_OK) return res;
+    if(curlu) vm.decVarRef(curlu);
+    curlu = _curlu;
+    if(curlu) vm.incVarRef(curlu);
+    return res;
+#else
+    return _curlu ? CURLE_UNKNOWN_OPTION : CURLE_OK;
+#endif
+}
+String VarCurl::getRequestUrl()
+{
+    if(!curlu) return url;
+    char *full = nullptr;
+    if(curl_url_get(curlu->getVal(), CURLUPART_URL, &full, 0) != CURLUE_OK) return {};
+    String res(full);
+    curl_free(full);
+    return res;
+}
+CURLcode VarCurl::setStreamDep(VirtualMachine &vm, CURLoption opt, VarCurl *_streamDep)
+{
+    CURLcode res = curl_easy_setopt(val, opt, _streamDep ? _streamDep->getVal() : nullptr);
+    if(res != CURLE_OK) return res;
+    if(streamDep) vm.decVarRef(streamDep);
+    streamDep    = _streamDep;
+    streamDepOpt = opt;
+    if(streamDep) vm.incVarRef(streamDep);
+    return res;
+}
+void VarCurl::setRateLimits(VirtualMachine &vm, VarCurlRateLimit *_recvLimit,
+                            VarCurlRateLimit *_sendLimit)
+{
+    if(_recvLimit) vm.incVarRef(_recvLimit);
+    if(_sendLimit) vm.incVarRef(_sendLimit);
+    if(recvLimit) vm.decVarRef(recvLimit);
+    if(sendLimit) vm.decVarRef(sendLimit);
+    recvLimit = _recvLimit;
+    sendLimit = _sendLimit;
+}
+void VarCurl::setCache(VirtualMachine &vm, VarCurlCache *_cache)
+{
+    if(_cache) vm.incVarRef(_cache);
+    if(cache) vm.decVarRef(cache);
+    cache = _cache;
+}
+void VarCurl::trackRequestOpt(int opt, Var *arg)
+{
+    // the long options are set to an Int or a Bool, and reset the method to GET when disabled
+    bool enabled = !arg->is<VarNil>();
+    if(arg->is<VarInt>()) enabled = as<VarInt>(arg)->getVal() != 0;
+    else if(arg->is<VarBool>()) enabled = as<VarBool>(arg)->getVal();
+    switch(opt) {
+    case CURLOPT_URL: url = enabled ? as<VarStr>(arg)->getVal() : String(); break;
+    case CURLOPT_CUSTOMREQUEST:
+        customMethod = enabled ? as<VarStr>(arg)->getVal() : String();
+        break;
+    case CURLOPT_HTTPGET:
+        if(enabled) method = "GET";
+        break;
+    case CURLOPT_POST: method = enabled ? "POST" : "GET"; break;
+    case CURLOPT_POSTFIELDS: // fallthrough
+    case CURLOPT_COPYPOSTFIELDS:
+    case CURLOPT_MIMEPOST:
+        if(enabled) method = "POST";
+        break;
+    case CURLOPT_UPLOAD: method = enabled ? "PUT" : "GET"; break;
+    case CURLOPT_NOBODY: method = enabled ? "HEAD" : "GET"; break;
+    case CURLOPT_COOKIE: cookieOpt = enabled; break;
+    case CURLOPT_NOPROGRESS: noProgress = enabled; break;
+    }
+}
+VarCurl *VarCurl::clone(VirtualMachine &vm, ModuleLoc loc)
+{
+    // libcurl copies the options, strings, and mime data, but the string lists are only referenced
+    CURL *dup = curl_easy_duphandle(val);
+    if(!dup) {
+        vm.fail(loc, "failed to run curl_easy_duphandle()");
+        return nullptr;
+    }
+    VarCurl *res = vm.makeVar<VarCurl>(loc, dup);
+
+    Vector<Var *> &pArgs = progCBArgs->getVal();
+    Vector<Var *> &wArgs = writeCBArgs->getVal();
+    Vector<Var *> &rArgs = readCBArgs->getVal();
+    Vector<Var *> &hArgs = headerCBArgs->getVal();
+    res->setProgressCB(vm, progCB, Span<Var *>(pArgs.begin() + 5, pArgs.end()));
+    res->setWriteCB(vm, writeCB, Span<Var *>(wArgs.begin() + 2, wArgs.end()));
+    res->setReadCB(vm, readCB, Span<Var *>(rArgs.begin() + 2, rArgs.end()));
+    res->setHeaderCB(vm, headerCB, Span<Var *>(hArgs.begin() + 2, hArgs.end()));
+
+    switch(writeMode) {
+    case CurlWriteMode::FILE_STREAM: res->setWriteFile(vm, writeFile); break;
+    case CurlWriteMode::FILE_DESC: res->setWriteFd(vm, writeFd); break;
+    case CurlWriteMode::BUFFER: res->setWriteBuffered(vm, true); break;
+    case CurlWriteMode::JSON: res->setWriteJson(vm, true); break;
+    case CurlWriteMode::FERAL_FN: break;
+    }
+    switch(readMode) {
+    case CurlReadMode::FILE_STREAM: res->setReadFile(vm, readFile); break;
+    case CurlReadMode::FILE_DESC: res->setReadFd(vm, readFd); break;
+    case CurlReadMode::MAPPED_FILE: {
+        if(!res->setReadMappedFile(vm, readMap.path.c_str())) {
+            vm.fail(loc, "failed to memory map file: ", readMap.path);
+            vm.decVarRef(res);
+            return nullptr;
+        }
+        break;
+    }
+    case CurlReadMode::FERAL_FN: // fallthrough
+    case CurlReadMode::NONE: break;
+    }
+
+    for(auto &sl : slists) {
+        curl_slist *owned = nullptr;
+        for(curl_slist *it = sl.owned; it; it = it->next) {
+            owned = curl_slist_append(owned, it->data);
+        }
+        res->setSList(vm, sl.opt, owned, sl.shared);
+    }
+    if(share) res->setShare(vm, share);
+    if(curlu) res->setCurlUrl(vm, curlu);
+    if(streamDep) res->setStreamDep(vm, streamDepOpt, streamDep);
+    res->setRateLimits(vm, recvLimit, sendLimit);
+    res->setCache(vm, cache);
+    res->url          = url;
+    res->method       = method;
+    res->customMethod = customMethod;
+    res->cookieOpt    = cookieOpt;
+    res->noProgress   = noProgress;
+    res->progThrottle.intervalMs    = progThrottle.intervalMs;
+    res->progThrottle.intervalBytes = progThrottle.intervalBytes;
+    res->setWriteCoalesce(writeCoalesceBytes);
+    return res;
+}
+bool VarCurl::appendWriteBuf(const char *data, size_t len)
+{
+    size_t required = writeBuf.size() + len;
+    if(writeBuf.empty()) {
+        // first chunk of the response - the headers are already in, so reserve the whole body
+        curl_off_t contentLen = -1;
+        curl_easy_getinfo(val, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLen);
+        if(contentLen > 0 && (size_t)contentLen > required) {
+            required = std::max(required, std::min<size_t>(contentLen, CURL_WRITE_BUF_MAX_RESERVE));
+        }
+    }
+    // this runs in a C callback of libcurl, which an exception must not go through
+    try {
+        if(required > writeBuf.capacity()) {
+            writeBuf.reserve(std::max(required, writeBuf.capacity() * 2));
+        }
+        writeBuf.append(data, len);
+    } catch(const std::bad_alloc &) {
+        return false;
+    }
+    return true;
+}
+
+bool VarCurl::writeFeral(VirtualMachine &vm, ModuleLoc loc, StringRef data)
+{
+    if(writeCoalesced.empty() && data.size() >= writeCoalesceBytes) {
+        return callFeralWriteCB(vm, loc, this, data);
+    }
+    if(writeCoalesced.capacity() < writeCoalesceBytes) writeCoalesced.reserve(writeCoalesceBytes);
+    writeCoalesced.append(data);
+    if(writeCoalesced.size() < writeCoalesceBytes) return true;
+    return flushFeralWrite(vm, loc);
+}
+bool VarCurl::flushFeralWrite(VirtualMachine &vm, ModuleLoc loc)
+{
+    if(writeCoalesced.empty()) return true;
+    if(!writeCB) {
+        writeCoalesced.clear();
+        return true;
+    }
+    // swapped into the argument instead of copied, and back after the call to keep the capacity
+    String &arg = as<VarStr>(writeCBArgs->at(1))->getVal();
+    arg.swap(writeCoalesced);
+    bool ok = true;
+    if(!writeCB->call(vm, loc, writeCBArgs->getVal(), nullptr)) {
+        vm.fail(loc, "failed to call write callback, check error above");
+        ok = false;
+    }
+    arg.swap(writeCoalesced);
+    writeCoalesced.clear();
+    return ok;
+}
+
+void VarCurl::prepareTransfer(CurlCallbackData *cbdata)
+{
+    curl_easy_setopt(val, CURLOPT_XFERINFODATA, cbdata);
+    curl_easy_setopt(val, CURLOPT_WRITEDATA, cbdata);
+    curl_easy_setopt(val, CURLOPT_READDATA, cbdata);
+    curl_easy_setopt(val, CURLOPT_SEEKDATA, cbdata);
+    curl_easy_setopt(val, CURLOPT_HEADERDATA, cbdata);
+    writeBuf.clear();
+    respHeaders.clear();
+    lastRespHeader.clear();
+    readOffset = 0;
+    readPending.clear();
+    readPendingOffset = 0;
+    writeCoalesced.clear();
+    jsonParser.reset();
+    cacheStatus = CurlCacheStatus::NONE;
+    progThrottle.reset();
+}
+bool VarCurl::finishTransfer(VirtualMachine &vm, ModuleLoc loc)
+{
+    // whatever was received is passed on, even if the transfer failed
+    if(!flushFeralWrite(vm, loc)) return false;
+    if(!progCB || !progThrottle.pending) return true;
+    progThrottle.pending = false;
+    curl_off_t *last     = progThrottle.last;
+    return callFeralProgressCB(vm, loc, this, last[0], last[1], last[2], last[3]);
+}
+
+CurlCallbackData::CurlCallbackData(ModuleLoc loc, VirtualMachine &vm, VarCurl *curl)
+    : loc(loc), vm(vm), curl(curl), async(nullptr), multi(nullptr), cacheWrite(nullptr)
+{}
+
+CurlAsyncState::CurlAsyncState(ModuleLoc loc, VirtualMachine &vm, VarCurl *curl)
+    : cbdata(loc, vm, curl), writeQueueBytes(0), progress{0, 0, 0, 0}, progressPending(false),
+      cancelled(false), done(false), result(CURLE_OK)
+{
+    cbdata.async = this;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// Worker Pool /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Native threads on which the performAsync() transfers run
+class CurlWorkerPool
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    Vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    bool stopping;
+
+    void run()
+    {
+        while(true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return stopping || !jobs.empty(); });
+                if(jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    CurlWorkerPool() : stopping(false) {}
+    ~CurlWorkerPool() { stop(); }
+
+    void submit(std::function<void()> job)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        // the threads are started lazily, since most scripts never use performAsync()
+        if(workers.empty()) {
+            size_t count = std::max(2u, std::thread::hardware_concurrency());
+            for(size_t i = 0; i < count; ++i) workers.emplace_back(&CurlWorkerPool::run, this);
+        }
+        jobs.push_back(std::move(job));
+        cv.notify_one();
+    }
+    // finishes the queued jobs and joins all the threads
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+            cv.notify_all();
+        }
+        for(auto &w : workers) w.join();
+        workers.clear();
+        stopping = false;
+    }
+};
+
+static CurlWorkerPool curlWorkerPool;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlFuture ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlFuture::VarCurlFuture(ModuleLoc loc, VarCurl *curl, std::shared_ptr<CurlAsyncState> state)
+    : Var(loc, 0), curl(curl), state(state), released(false)
+{}
+
+void VarCurlFuture::onCreate(VirtualMachine &vm) { vm.incVarRef(curl); }
+void VarCurlFuture::onDestroy(VirtualMachine &vm)
+{
+    {
+        // abort the transfer if it's still running - the worker thread must be done with curl
+        // before it can be released
+        std::unique_lock<std::mutex> lock(state->mtx);
+        state->cancelled = true;
+        state->cv.notify_all();
+        state->cv.wait(lock, [&]() { return state->done; });
+    }
+    if(!released) curl->setAsyncBusy(false);
+    vm.decVarRef(curl);
+}
+
+bool VarCurlFuture::wait(VirtualMachine &vm, ModuleLoc loc, int64_t timeoutMs, bool &isDone)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    Vector<String> chunks;
+    curl_off_t progress[4];
+    isDone = false;
+    while(!isDone) {
+        bool hasProgress = false;
+        {
+            std::unique_lock<std::mutex> lock(state->mtx);
+            auto ready = [&]() {
+                return state->done || state->progressPending || !state->writeQueue.empty();
+            };
+            if(timeoutMs < 0) state->cv.wait(lock, ready);
+            else if(!state->cv.wait_until(lock, deadline, ready)) return true;
+            chunks.clear();
+            chunks.swap(state->writeQueue);
+            state->writeQueueBytes = 0;
+            hasProgress            = state->progressPending;
+            state->progressPending = false;
+            std::copy(state->progress, state->progress + 4, progress);
+            // the worker is done only after its last callback, so everything is in chunks now
+            isDone = state->done;
+            state->cv.notify_all();
+        }
+        bool ok = true;
+        for(auto &chunk : chunks) {
+            if(!(ok = curl->writeFeral(vm, loc, chunk))) break;
+        }
+        if(ok && hasProgress && curl->getProgressCB()) {
+            ok = callFeralProgressCB(vm, loc, curl, progress[0], progress[1], progress[2],
+                                     progress[3]);
+        }
+        if(!ok) {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            state->cancelled = true;
+            state->cv.notify_all();
+            return false;
+        }
+        if(timeoutMs >= 0 && std::chrono::steady_clock::now() >= deadline) break;
+    }
+    if(isDone && !released) {
+        curl->setAsyncBusy(false);
+        released = true;
+        return curl->finishTransfer(vm, loc);
+    }
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlSList ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlSList::VarCurlSList(ModuleLoc loc, curl_slist *val) : Var(loc, 0), val(val) {}
+VarCurlSList::~VarCurlSList() { curl_slist_free_all(val); }
+
+curl_slist *createSList(VirtualMachine &vm, ModuleLoc loc, Var *data)
+{
+    curl_slist *lst = nullptr;
+    if(data->is<VarStr>()) {
+        lst = curl_slist_append(lst, as<VarStr>(data)->getVal().c_str());
+    } else if(data->is<VarVec>()) {
+        for(auto &item : as<VarVec>(data)->getVal()) {
+            Var *v = nullptr;
+            Array<Var *, 1> tmp{item};
+            if(!vm.callVarAndExpect<VarStr>(loc, "str", v, tmp, {})) {
+                curl_slist_free_all(lst);
+                return nullptr;
+            }
+            lst = curl_slist_append(lst, as<VarStr>(v)->getVal().c_str());
+            vm.decVarRef(v);
+        }
+    } else if(data->is<VarMap>()) {
+        String tmpStr;
+        VarMap *map = as<VarMap>(data);
+        for(auto &item : map->getVal()) {
+            Var *v = nullptr;
+            Array<Var *, 1> tmp{item.second};
+            if(!vm.callVarAndExpect<VarStr>(loc, "str", v, tmp, {})) {
+                curl_slist_free_all(lst);
+                return nullptr;
+            }
+            const String &str = as<VarStr>(v)->getVal();
+            tmpStr.clear();
+            tmpStr += item.first;
+            tmpStr += ": ";
+            tmpStr += str.c_str();
+            lst = curl_slist_append(lst, tmpStr.c_str());
+            vm.decVarRef(v);
+        }
+    } else {
+        vm.fail(loc, "expected a string, vector, or map to create the string list from");
+        return nullptr;
+    }
+    if(!lst) vm.fail(loc, "failed to create string list from the given data (possibly empty)");
+    return lst;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// VarCurlUrl /////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlUrl::VarCurlUrl(ModuleLoc loc, CURLU *val) : Var(loc, 0), val(val) {}
+VarCurlUrl::~VarCurlUrl() { curl_url_cleanup(val); }
+
+String curlUrlStrerror(CURLUcode code)
+{
+#if CURL_AT_LEAST_VERSION(7, 80, 0)
+    return curl_url_strerror(code);
+#else
+    return "URL error " + std::to_string(code);
+#endif
+}
+
+// Returns whether `code` is the result of getting a part which is not in the URL
+bool isMissingUrlPart(CURLUcode code)
+{
+#if CURL_AT_LEAST_VERSION(7, 81, 0)
+    if(code == CURLUE_NO_ZONEID) return true;
+#endif
+    return code >= CURLUE_NO_SCHEME && code <= CURLUE_NO_FRAGMENT;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////// VarCurlPool ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlPool::VarCurlPool(ModuleLoc loc, size_t maxHandles) : Var(loc, 0), maxHandles(maxHandles)
+{}
+
+void VarCurlPool::onDestroy(VirtualMachine &vm)
+{
+    for(auto &h : idle) vm.decVarRef(h);
+    idle.clear();
+}
+
+VarCurl *VarCurlPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(idle.empty()) return nullptr;
+    VarCurl *curl = idle.back();
+    idle.pop_back();
+    return curl;
+}
+void VarCurlPool::release(VirtualMachine &vm, VarCurl *curl)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(idle.size() >= maxHandles) return;
+    if(std::find(idle.begin(), idle.end(), curl) != idle.end()) return;
+    curl->reset(vm);
+    vm.incVarRef(curl);
+    idle.push_back(curl);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlShare ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlShare::VarCurlShare(ModuleLoc loc, CURLSH *val) : Var(loc, 0), val(val), sharedData(0)
+{
+    curl_share_setopt(val, CURLSHOPT_LOCKFUNC, curlShareLockCallback);
+    curl_share_setopt(val, CURLSHOPT_UNLOCKFUNC, curlShareUnlockCallback);
+    curl_share_setopt(val, CURLSHOPT_USERDATA, this);
+}
+VarCurlShare::~VarCurlShare() { curl_share_cleanup(val); }
+CURLSHcode VarCurlShare::setShared(curl_lock_data data, bool enabled)
+{
+    CURLSHcode res = curl_share_setopt(val, enabled ? CURLSHOPT_SHARE : CURLSHOPT_UNSHARE, data);
+    if(res != CURLSHE_OK || (unsigned)data >= CURL_LOCK_DATA_LAST) return res;
+    if(enabled) sharedData |= 1u << data;
+    else sharedData &= ~(1u << data);
+    return res;
+}
+bool VarCurlShare::sharesConnections()
+{
+#if CURL_AT_LEAST_VERSION(7, 57, 0)
+    return sharedData & (1u << CURL_LOCK_DATA_CONNECT);
+#else
+    return false;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////// VarCurlRateLimit //////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlRateLimit::VarCurlRateLimit(ModuleLoc loc, size_t bytesPerSec, size_t burst)
+    : Var(loc, 0), lastRefill(std::chrono::steady_clock::now()), tokens(0), bytesPerSec(0),
+      burst(0)
+{
+    setRate(bytesPerSec, burst);
+    tokens = this->burst;
+}
+
+void VarCurlRateLimit::refill(std::chrono::steady_clock::time_point now)
+{
+    std::chrono::duration<double> elapsed = now - lastRefill;
+    lastRefill                            = now;
+    tokens = std::min<double>(burst, tokens + elapsed.count() * bytesPerSec);
+}
+
+void VarCurlRateLimit::setRate(size_t _bytesPerSec, size_t _burst)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    refill(std::chrono::steady_clock::now());
+    bytesPerSec = _bytesPerSec;
+    burst       = _burst > 0 ? _burst : std::max<size_t>(bytesPerSec / 10, 16 * 1024);
+    tokens      = std::min<double>(tokens, burst);
+}
+std::chrono::steady_clock::duration VarCurlRateLimit::getWait()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if(bytesPerSec == 0) return {};
+    refill(std::chrono::steady_clock::now());
+    if(tokens > 0) return {};
+    return std::chrono::ceil<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(-tokens / bytesPerSec));
+}
+void VarCurlRateLimit::take(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    tokens -= bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlCache ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+CurlSha256::CurlSha256() { reset(); }
+
+void CurlSha256::reset()
+{
+    static constexpr uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::copy(initial, initial + 8, state);
+    length = 0;
+}
+void CurlSha256::compress(const uint8_t *data)
+{
+    uint32_t w[64];
+    for(int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+               (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+    }
+    for(int i = 16; i < 64; ++i) {
+        uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i]        = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    // a to h
+    uint32_t v[8];
+    std::copy(state, state + 8, v);
+    for(int i = 0; i < 64; ++i) {
+        uint32_t s1  = std::rotr(v[4], 6) ^ std::rotr(v[4], 11) ^ std::rotr(v[4], 25);
+        uint32_t ch  = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1  = v[7] + s1 + ch + sha256K[i] + w[i];
+        uint32_t s0  = std::rotr(v[0], 2) ^ std::rotr(v[0], 13) ^ std::rotr(v[0], 22);
+        uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        std::copy_backward(v, v + 7, v + 8);
+        v[4] += t1;
+        v[0] = t1 + s0 + maj;
+    }
+    for(int i = 0; i < 8; ++i) state[i] += v[i];
+}
+void CurlSha256::update(const char *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t used      = length % 64;
+    length += len;
+    if(used > 0) {
+        size_t n = std::min(len, 64 - used);
+        memcpy(block + used, p, n);
+        p += n;
+        len -= n;
+        if(used + n < 64) return;
+        compress(block);
+    }
+    for(; len >= 64; p += 64, len -= 64) compress(p);
+    memcpy(block, p, len);
+}
+String CurlSha256::hexDigest()
+{
+    // 0x80, zeros up to 8 bytes before the end of a block, and the length in bits (big endian)
+    uint64_t bits  = length * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padLen   = 64 - (length + 8) % 64;
+    for(int i = 0; i < 8; ++i) pad[padLen + i] = bits >> (56 - i * 8);
+    update((const char *)pad, padLen + 8);
+
+    static const char digits[] = "0123456789abcdef";
+    String res(64, '0');
+    for(int i = 0; i < 32; ++i) {
+        uint8_t byte   = state[i / 4] >> (24 - (i % 4) * 8);
+        res[i * 2]     = digits[byte >> 4];
+        res[i * 2 + 1] = digits[byte & 15];
+    }
+    reset();
+    return res;
+}
+
+CurlCacheWrite::CurlCacheWrite() : size(0), fd(-1), failed(false) {}
+CurlCacheWrite::~CurlCacheWrite()
+{
+#if !defined(_WIN32)
+    if(fd >= 0) ::close(fd);
+    if(!tmpPath.empty()) unlink(tmpPath.c_str());
+#endif
+}
+
+bool CurlCacheWrite::open(const String &dir)
+{
+#if defined(_WIN32)
+    return false;
+#else
+    // in the store itself, so that it can be renamed into place
+    tmpPath = dir + "/blobs/.tmp-XXXXXX";
+    fd      = mkstemp(tmpPath.data());
+    if(fd < 0) tmpPath.clear();
+    return fd >= 0;
+#endif
+}
+void CurlCacheWrite::write(const char *data, size_t len)
+{
+    if(fd < 0 || failed) return;
+    hash.update(data, len);
+    size += len;
+    failed = writeToFd(fd, data, len) < len;
+}
+String CurlCacheWrite::close()
+{
+    if(fd < 0) return {};
+#if !defined(_WIN32)
+    if(::close(fd) != 0) failed = true;
+#endif
+    fd = -1;
+    return failed ? String() : hash.hexDigest();
+}
+
+// Returns whether the request header `line` is the header `name` (lowercase)
+bool isHeaderLine(StringRef line, StringRef name)
+{
+    if(line.size() <= name.size() || line[name.size()] != ':') return false;
+    return std::equal(name.begin(), name.end(), line.begin(),
+                      [](char a, char b) { return a == std::tolower((unsigned char)b); });
+}
+
+// Returns the items of the comma separated header value `list`, trimmed and in lowercase
+Vector<String> splitHeaderList(StringRef list)
+{
+    Vector<String> res;
+    while(!list.empty()) {
+        size_t comma   = list.find(',');
+        StringRef item = list.substr(0, comma);
+        list           = comma == StringRef::npos ? StringRef() : list.substr(comma + 1);
+        while(!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if(item.empty()) continue;
+        res.emplace_back(item);
+        for(auto &c : res.back()) c = std::tolower((unsigned char)c);
+    }
+    return res;
+}
+
+// Appends the values of the request headers `names` (lowercase) to key, each after a separator
+void appendHeaderValues(String &key, const Vector<String> &names, curl_slist *reqHeaders)
+{
+    for(auto &name : names) {
+        // the parts are separated by a control character, which cannot be in a URL or a header
+        key += '\x1f';
+        for(curl_slist *it = reqHeaders; it; it = it->next) {
+            if(!isHeaderLine(it->data, name)) continue;
+            StringRef value(it->data + name.size() + 1);
+            while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                value.remove_prefix(1);
+            }
+            key += value;
+            break;
+        }
+    }
+}
+
+// Returns whether the request sent credentials, whose response is private to the user unless the
+// server says otherwise - libcurl does not expose the cookies it sent, so any in its cookie engine
+// count
+bool sentCredentials(VarCurl *curl, curl_slist *reqHeaders)
+{
+    for(curl_slist *it = reqHeaders; it; it = it->next) {
+        if(isHeaderLine(it->data, "authorization") || isHeaderLine(it->data, "cookie")) {
+            return true;
+        }
+    }
+    long authUsed = 0;
+    curl_easy_getinfo(curl->getVal(), CURLINFO_HTTPAUTH_USED, &authUsed);
+    if(authUsed != 0 || curl->hasCookieOpt()) return true;
+    curl_slist *cookies = nullptr;
+    curl_easy_getinfo(curl->getVal(), CURLINFO_COOKIELIST, &cookies);
+    bool res = cookies != nullptr;
+    curl_slist_free_all(cookies);
+    return res;
+}
+
+VarCurlCache::VarCurlCache(ModuleLoc loc, StringRef dir, const Vector<String> &keyHeaders,
+                           size_t maxBytes)
+    : Var(loc, 0), dir(dir), keyHeaders(keyHeaders), maxBytes(maxBytes), storeBytes(0)
+{
+    for(auto &name : this->keyHeaders) {
+        for(auto &c : name) c = std::tolower((unsigned char)c);
+    }
+}
+
+bool VarCurlCache::init(String &err)
+{
+#if defined(_WIN32)
+    err = "the cache is not supported on Windows";
+    return false;
+#else
+    for(const String &path : {dir, dir + "/blobs", dir + "/meta"}) {
+        if(mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) continue;
+        err = path + ": " + strerror(errno);
+        return false;
+    }
+    prune();
+    return true;
+#endif
+}
+
+String VarCurlCache::makeKey(const String &url, curl_slist *reqHeaders)
+{
+    String key = "GET " + url;
+    appendHeaderValues(key, keyHeaders, reqHeaders);
+    return key;
+}
+
+String VarCurlCache::getVary(const CurlCacheEntry &entry, curl_slist *reqHeaders)
+{
+    auto vary = entry.headers.find("vary");
+    if(vary == entry.headers.end()) return {};
+    String res;
+    appendHeaderValues(res, splitHeaderList(vary->second), reqHeaders);
+    return res;
+}
+
+String VarCurlCache::getMetaPath(const String &key)
+{
+    CurlSha256 hash;
+    hash.update(key.data(), key.size());
+    return dir + "/meta/" + hash.hexDigest();
+}
+
+// The metadata file of an entry is made of lines of:
+//   <key>
+//   <blob>
+//   <storedAt> <maxAge>
+//   <vary>
+//   <name>: <value>   (for each header)
+bool VarCurlCache::readMeta(const String &path, CurlCacheEntry &entry)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if(!f) return false;
+    String data;
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+
+    StringRef rest(data), line;
+    auto nextLine = [&]() {
+        size_t end = rest.find('\n');
+        if(end == StringRef::npos) return false;
+        line = rest.substr(0, end);
+        rest.remove_prefix(end + 1);
+        return true;
+    };
+    if(!nextLine()) return false;
+    entry.key.assign(line);
+    if(!nextLine() || line.size() != 64) return false;
+    entry.blob.assign(line);
+    long long storedAt = 0, maxAge = 0;
+    if(!nextLine() || sscanf(String(line).c_str(), "%lld %lld", &storedAt, &maxAge) != 2) {
+        return false;
+    }
+    entry.storedAt = storedAt;
+    entry.maxAge   = maxAge;
+    if(!nextLine()) return false;
+    entry.vary.assign(line);
+    entry.headers.clear();
+    while(nextLine()) {
+        size_t colon = line.find(':');
+        if(colon == StringRef::npos || colon + 2 > line.size()) return false;
+        entry.headers.emplace(line.substr(0, colon), line.substr(colon + 2));
+    }
+    return true;
+}
+
+bool VarCurlCache::load(const String &key, CurlCacheEntry &entry)
+{
+    // a different key with the same hash is as good as a miss
+    return readMeta(getMetaPath(key), entry) && entry.key == key;
+}
+
+bool VarCurlCache::save(const CurlCacheEntry &entry)
+{
+#if defined(_WIN32)
+    return false;
+#else
+    String data = entry.key + "\n" + entry.blob + "\n" + std::to_string(entry.storedAt) + " " +
+                  std::to_string(entry.maxAge) + "\n" + entry.vary + "\n";
+    for(auto &h : entry.headers) {
+        data += h.first;
+        data += ": ";
+        data += h.second;
+        data += '\n';
+    }
+    // written to a temporary file first, so that the entry is never seen half written
+    String path    = getMetaPath(entry.key);
+    String tmpPath = path + ".XXXXXX";
+    int fd         = mkstemp(tmpPath.data());
+    if(fd < 0) return false;
+    bool ok = writeToFd(fd, data.data(), data.size()) == data.size();
+    ok      = ::close(fd) == 0 && ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if(!ok) unlink(tmpPath.c_str());
+    return ok;
+#endif
+}
+
+void VarCurlCache::prune(size_t incoming)
+{
+#if !defined(_WIN32)
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    int64_t now     = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+    // calls fn(name, path, stat) for each file in the directory `sub` of the cache
+    auto forEachFile = [&](const char *sub, auto &&fn) {
+        String subDir = dir + "/" + sub + "/";
+        DIR *d        = opendir(subDir.c_str());
+        if(!d) return;
+        while(struct dirent *ent = readdir(d)) {
+            StringRef name(ent->d_name);
+            String path = subDir + ent->d_name;
+            struct stat st;
+            if(name == "." || name == ".." || stat(path.c_str(), &st) != 0) continue;
+            if(S_ISREG(st.st_mode)) fn(name, path, st);
+        }
+        closedir(d);
+    };
+    // the files being written have a '.' in their names, and are kept unless they are left over
+    auto removeLeftover = [&](const String &path, const struct stat &st) {
+        if(now - st.st_mtime > CURL_CACHE_TMP_MAX_AGE_SEC) unlink(path.c_str());
+    };
+
+    struct BlobInfo
+    {
+        size_t size;
+        size_t entries;
+    };
+    struct MetaInfo
+    {
+        String path;
+        String blob;
+        int64_t storedAt;
+    };
+    StringMap<BlobInfo> blobs;
+    Vector<MetaInfo> metas;
+    forEachFile("blobs", [&](StringRef name, const String &path, const struct stat &st) {
+        if(name.find('.') != StringRef::npos) removeLeftover(path, st);
+        else blobs[String(name)] = {(size_t)st.st_size, 0};
+    });
+    CurlCacheEntry entry;
+    forEachFile("meta", [&](StringRef name, const String &path, const struct stat &st) {
+        if(name.find('.') != StringRef::npos) {
+            removeLeftover(path, st);
+            return;
+        }
+        auto blob = readMeta(path, entry) ? blobs.find(entry.blob) : blobs.end();
+        if(blob == blobs.end() || now > entry.storedAt + entry.maxAge + CURL_CACHE_MAX_STALE_SEC) {
+            unlink(path.c_str());
+            return;
+        }
+        ++blob->second.entries;
+        metas.push_back({path, entry.blob, entry.storedAt});
+    });
+
+    storeBytes = 0;
+    for(auto it = blobs.begin(); it != blobs.end();) {
+        if(it->second.entries > 0) {
+            storeBytes += it->second.size;
+            ++it;
+            continue;
+        }
+        unlink((dir + "/blobs/" + it->first).c_str());
+        it = blobs.erase(it);
+    }
+    if(storeBytes + incoming <= maxBytes) return;
+    // evicts down to 3/4 of the limit, so that the store is not pruned again right away
+    std::sort(metas.begin(), metas.end(),
+              [](const MetaInfo &a, const MetaInfo &b) { return a.storedAt < b.storedAt; });
+    for(auto &meta : metas) {
+        if(storeBytes + incoming <= maxBytes / 4 * 3) break;
+        unlink(meta.path.c_str());
+        BlobInfo &blob = blobs[meta.blob];
+        if(--blob.entries > 0) continue;
+        unlink((dir + "/blobs/" + meta.blob).c_str());
+        storeBytes -= blob.size;
+    }
+#endif
+}
+
+bool VarCurlCache::setFreshness(CurlCacheEntry &entry, int64_t now, bool credentials)
+{
+    auto getHeader = [&](const char *name) -> const String * {
+        auto it = entry.headers.find(name);
+        return it == entry.headers.end() ? nullptr : &it->second;
+    };
+    // without max-age or Expires, the response is stale right away (and always revalidated)
+    int64_t maxAge  = -1;
+    int64_t sMaxAge = -1;
+    bool noCache    = false;
+    bool cacheable  = false; // explicitly, even for a request with credentials
+    // the store is treated as a shared cache, since any number of users and processes can use it
+    if(const String *cacheControl = getHeader("cache-control")) {
+        for(auto &item : splitHeaderList(*cacheControl)) {
+            if(item == "no-store" || item == "private" || item.starts_with("private=")) {
+                return false;
+            }
+            if(item == "no-cache") noCache = true;
+            else if(item == "public" || item == "must-revalidate") cacheable = true;
+            else if(item.starts_with("max-age=")) {
+                maxAge = std::strtoll(item.c_str() + 8, nullptr, 10);
+            } else if(item.starts_with("s-maxage=")) {
+                sMaxAge   = std::strtoll(item.c_str() + 9, nullptr, 10);
+                cacheable = true;
+            }
+        }
+    }
+    if(credentials && !cacheable) return false;
+    // the response differs for every request
+    if(const String *vary = getHeader("vary")) {
+        for(auto &name : splitHeaderList(*vary)) {
+            if(name == "*") return false;
+        }
+    }
+    if(sMaxAge >= 0) maxAge = sMaxAge;
+    const String *expires = getHeader("expires");
+    if(maxAge < 0 && expires) {
+        // relative to the server's Date, in case its clock is off
+        const String *date = getHeader("date");
+        time_t expiresAt   = curl_getdate(expires->c_str(), nullptr);
+        time_t dateAt      = date ? curl_getdate(date->c_str(), nullptr) : -1;
+        if(expiresAt >= 0) maxAge = expiresAt - (dateAt >= 0 ? dateAt : now);
+    }
+    const String *age = getHeader("age");
+    entry.storedAt    = now - (age ? std::max<int64_t>(0, std::atoll(age->c_str())) : 0);
+    entry.maxAge      = noCache ? 0 : std::max<int64_t>(0, maxAge);
+    return true;
+}
+
+bool VarCurlCache::deliver(CurlCallbackData &cbdata, CurlMappedFile &body, CURLcode &res)
+{
+    VarCurl *curl = cbdata.curl;
+    if(curl->getWriteMode() == CurlWriteMode::BUFFER) {
+        curl->getWriteBuf().assign(body.data, body.size);
+        return true;
+    }
+    for(size_t off = 0; off < body.size; off += CURL_CACHE_DELIVER_CHUNK) {
+        size_t len = std::min(body.size - off, CURL_CACHE_DELIVER_CHUNK);
+        if(writeResponse(cbdata, body.data + off, len) == len) continue;
+        // the Feral write callback has failed the VM already
+        if(curl->getWriteMode() == CurlWriteMode::FERAL_FN) return false;
+        res = CURLE_WRITE_ERROR;
+        break;
+    }
+    return true;
+}
+
+bool VarCurlCache::perform(CurlCallbackData &cbdata, const String &url, CURLcode &res)
+{
+    VarCurl *curl          = cbdata.curl;
+    CURL *easy             = curl->getVal();
+    curl_slist *reqHeaders = curl->getSList(CURLOPT_HTTPHEADER);
+    auto sinceEpoch        = std::chrono::system_clock::now().time_since_epoch();
+    int64_t now            = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+
+    CurlCacheEntry entry;
+    CurlMappedFile body;
+    String key = makeKey(url, reqHeaders);
+    // a response stored for other values of the headers named in its Vary is a miss, and replaced
+    bool cached = load(key, entry) && entry.vary == getVary(entry, reqHeaders) &&
+                  body.open((dir + "/blobs/" + entry.blob).c_str());
+    if(cached && now < entry.storedAt + entry.maxAge) {
+        res = CURLE_OK;
+        curl->setCacheStatus(CurlCacheStatus::HIT);
+        curl->getRespHeaders() = entry.headers;
+        if(!deliver(cbdata, body, res)) return false;
+        return curl->finishTransfer(cbdata.vm, cbdata.loc);
+    }
+
+    // a stale response is revalidated, so that the body is not sent again if it is unchanged
+    curl_slist *condHeaders = nullptr;
+    if(cached) {
+        for(curl_slist *it = reqHeaders; it; it = it->next) {
+            if(isHeaderLine(it->data, "if-none-match")) continue;
+            if(isHeaderLine(it->data, "if-modified-since")) continue;
+            condHeaders = curl_slist_append(condHeaders, it->data);
+        }
+        auto etag = entry.headers.find("etag");
+        if(etag != entry.headers.end()) {
+            String header = "If-None-Match: " + etag->second;
+            condHeaders   = curl_slist_append(condHeaders, header.c_str());
+        }
+        auto lastModified = entry.headers.find("last-modified");
+        if(lastModified != entry.headers.end()) {
+            String header = "If-Modified-Since: " + lastModified->second;
+            condHeaders   = curl_slist_append(condHeaders, header.c_str());
+        }
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, condHeaders);
+    }
+    CurlCacheWrite write;
+    if(write.open(dir)) cbdata.cacheWrite = &write;
+    res = curl_easy_perform(easy);
+    recordTransferStats(easy, res);
+    cbdata.cacheWrite = nullptr;
+    if(cached) {
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, reqHeaders);
+        curl_slist_free_all(condHeaders);
+    }
+
+    long code = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+    String blob      = write.close();
+    bool credentials = sentCredentials(curl, reqHeaders);
+    bool ok          = true;
+    curl->setCacheStatus(CurlCacheStatus::MISS);
+    if(res == CURLE_OK && cached && code == 304) {
+        // the stored headers are updated by the ones of the 304, except for the body's length
+        for(auto &h : curl->getRespHeaders()) {
+            if(h.first != "content-length") entry.headers[h.first] = h.second;
+        }
+        curl->getRespHeaders() = entry.headers;
+        entry.vary             = getVary(entry, reqHeaders);
+        // the entry is removed if the response can no longer be stored
+        if(setFreshness(entry, now, credentials)) save(entry);
+        else unlink(getMetaPath(key).c_str());
+        curl->setCacheStatus(CurlCacheStatus::REVALIDATED);
+        ok = deliver(cbdata, body, res);
+    } else if(res == CURLE_OK && code == 200 && !blob.empty()) {
+        entry.key     = key;
+        entry.blob    = blob;
+        entry.headers = curl->getRespHeaders();
+        entry.vary    = getVary(entry, reqHeaders);
+        // replaces the same body stored for any other request, which is identical
+        String blobPath = dir + "/blobs/" + blob;
+        if(!setFreshness(entry, now, credentials)) {
+            unlink(getMetaPath(key).c_str());
+        } else {
+            // pruned first (making room for it), so that the new entry is not the one evicted
+            if(storeBytes + write.size > maxBytes) prune(write.size);
+            if(rename(write.tmpPath.c_str(), blobPath.c_str()) == 0) {
+                write.tmpPath.clear();
+                save(entry);
+                storeBytes += write.size;
+            }
+        }
+    }
+    return curl->finishTransfer(cbdata.vm, cbdata.loc) && ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////// VarCurlMulti ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+VarCurlMulti::VarCurlMulti(ModuleLoc loc, CURLM *val)
+    : Var(loc, 0), val(val), timerSet(false), running(0), epollFd(-1)
+{
+    curl_multi_setopt(val, CURLMOPT_SOCKETFUNCTION, curlMultiSocketCallback);
+    curl_multi_setopt(val, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(val, CURLMOPT_TIMERFUNCTION, curlMultiTimerCallback);
+    curl_multi_setopt(val, CURLMOPT_TIMERDATA, this);
+}
+VarCurlMulti::~VarCurlMulti()
+{
+    curl_multi_cleanup(val);
+#if defined(__linux__)
+    if(epollFd >= 0) close(epollFd);
+#endif
+}
+
+void VarCurlMulti::onDestroy(VirtualMachine &vm)
+{
+    for(auto &cbdata : handles) {
+        curl_multi_remove_handle(val, cbdata->curl->getVal());
+        cbdata->curl->setMulti(nullptr);
+        vm.decVarRef(cbdata->curl);
+        delete cbdata;
+    }
+    handles.clear();
+    ratePaused.clear();
+}
+
+CURLMcode VarCurlMulti::addHandle(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl)
+{
+    // the callback data of a handle which is already in a multi handle must be left alone, so it
+    // is only bound once the handle is in - the transfer does not start until the next perform
+    if(curl->getMulti()) return CURLM_ADDED_ALREADY;
+    CURLMcode res = curl_multi_add_handle(val, curl->getVal());
+    if(res != CURLM_OK) return res;
+    CurlCallbackData *cbdata = new CurlCallbackData(loc, vm, curl);
+    cbdata->multi            = this;
+    curl->prepareTransfer(cbdata);
+    curl_easy_setopt(curl->getVal(), CURLOPT_PRIVATE, cbdata);
+    curl->setMulti(this);
+    vm.incVarRef(curl);
+    handles.push_back(cbdata);
+    return res;
+}
+CURLMcode VarCurlMulti::removeHandle(VirtualMachine &vm, VarCurl *curl)
+{
+    for(auto it = handles.begin(); it != handles.end(); ++it) {
+        if((*it)->curl != curl) continue;
+        CURLMcode res = curl_multi_remove_handle(val, curl->getVal());
+        curl->setMulti(nullptr);
+        delete *it;
+        handles.erase(it);
+        std::erase_if(ratePaused, [curl](auto &paused) { return paused.second == curl; });
+        vm.decVarRef(curl);
+        return res;
+    }
+    return CURLM_BAD_EASY_HANDLE;
+}
+void VarCurlMulti::setCallbackLoc(ModuleLoc loc)
+{
+    for(auto &cbdata : handles) cbdata->loc = loc;
+}
+
+// Returns the events `in` and/or `out` (EPOLLIN/EPOLLOUT or POLLIN/POLLOUT) to watch for, as per
+// the CURL_POLL_* `what`
+template<typename T> T curlPollMask(int what, T in, T out)
+{
+    return (T)((what & CURL_POLL_IN ? in : (T)0) | (what & CURL_POLL_OUT ? out : (T)0));
+}
+
+void VarCurlMulti::watchSocket(curl_socket_t sock, int what)
+{
+#if defined(__linux__)
+    if(epollFd >= 0) {
+        struct epoll_event ev = {};
+        ev.events  = curlPollMask<uint32_t>(what, EPOLLIN, EPOLLOUT);
+        ev.data.fd = sock;
+        if(what == CURL_POLL_REMOVE) epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, nullptr);
+        else if(sockets.find(sock) == sockets.end()) epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &ev);
+        else epoll_ctl(epollFd, EPOLL_CTL_MOD, sock, &ev);
+    }
+#endif
+    if(what == CURL_POLL_REMOVE) sockets.erase(sock);
+    else sockets[sock] = what;
+}
+void VarCurlMulti::setTimer(long timeoutMs)
+{
+    timerSet = timeoutMs >= 0;
+    if(timerSet) {
+        timerDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+}
+long VarCurlMulti::getTimeoutMs()
+{
+    long rateMs = getRateWaitMs();
+    if(!timerSet) return rateMs;
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        timerDeadline - std::chrono::steady_clock::now());
+    long timerMs = std::max<long>(0, remaining.count());
+    return rateMs >= 0 ? std::min(rateMs, timerMs) : timerMs;
+}
+
+void VarCurlMulti::pauseForRate(VarCurl *curl, std::chrono::steady_clock::duration wait)
+{
+    ratePaused.emplace_back(std::chrono::steady_clock::now() + wait, curl);
+}
+void VarCurlMulti::resumeRateLimited()
+{
+    if(ratePaused.empty()) return;
+    auto now = std::chrono::steady_clock::now();
+    Vector<VarCurl *> due;
+    std::erase_if(ratePaused, [&](auto &paused) {
+        if(paused.first > now) return false;
+        due.push_back(paused.second);
+        return true;
+    });
+    // this may call the callbacks right away, which can pause the handle again
+    for(auto &curl : due) curl_easy_pause(curl->getVal(), CURLPAUSE_CONT);
+}
+long VarCurlMulti::getRateWaitMs()
+{
+    if(ratePaused.empty()) return -1;
+    auto earliest = ratePaused.front().first;
+    for(auto &paused : ratePaused) earliest = std::min(earliest, paused.first);
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        earliest - std::chrono::steady_clock::now());
+    return std::max<long>(0, remaining.count());
+}
+
+CURLMcode VarCurlMulti::socketAction(curl_socket_t sock, int events)
+{
+    if(sock == CURL_SOCKET_TIMEOUT) {
+        timerSet = false; // libcurl sets it again, if needed
+        resumeRateLimited();
+    }
+    return curl_multi_socket_action(val, sock, events, &running);
+}
+
+CURLMcode VarCurlMulti::waitEvents(int timeoutMs, const char *&errMsg)
+{
+    errMsg      = nullptr;
+    long waitMs = getTimeoutMs();
+    // nothing to wait for (an empty or finished multi handle), which must not block forever
+    if(sockets.empty() && waitMs < 0) return CURLM_OK;
+    if(waitMs < 0 || (timeoutMs >= 0 && timeoutMs < waitMs)) waitMs = timeoutMs;
+    CURLMcode res = CURLM_OK;
+#if defined(__linux__)
+    if(epollFd < 0) {
+        if((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            errMsg = strerror(errno);
+            return res;
+        }
+        for(auto &sock : sockets) {
+            struct epoll_event ev = {};
+            ev.events  = curlPollMask<uint32_t>(sock.second, EPOLLIN, EPOLLOUT);
+            ev.data.fd = sock.first;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, sock.first, &ev);
+        }
+    }
+    struct epoll_event events[256];
+    int count = epoll_wait(epollFd, events, 256, waitMs);
+    if(count < 0 && errno != EINTR) {
+        errMsg = strerror(errno);
+        return res;
+    }
+    for(int i = 0; i < count && res == CURLM_OK; ++i) {
+        int ev = (events[i].events & EPOLLIN ? CURL_CSELECT_IN : 0) |
+                 (events[i].events & EPOLLOUT ? CURL_CSELECT_OUT : 0) |
+                 (events[i].events & (EPOLLERR | EPOLLHUP) ? CURL_CSELECT_ERR : 0);
+        res = socketAction(events[i].data.fd, ev);
+    }
+#elif !defined(_WIN32)
+    Vector<struct pollfd> fds;
+    fds.reserve(sockets.size());
+    for(auto &sock : sockets) {
+        fds.push_back({sock.first, curlPollMask<short>(sock.second, POLLIN, POLLOUT), 0});
+    }
+    int count = poll(fds.data(), fds.size(), waitMs);
+    if(count < 0 && errno != EINTR) {
+        errMsg = strerror(errno);
+        return res;
+    }
+    for(size_t i = 0; count > 0 && i < fds.size() && res == CURLM_OK; ++i) {
+        if(!fds[i].revents) continue;
+        int ev = (fds[i].revents & POLLIN ? CURL_CSELECT_IN : 0) |
+                 (fds[i].revents & POLLOUT ? CURL_CSELECT_OUT : 0) |
+                 (fds[i].revents & (POLLERR | POLLHUP) ? CURL_CSELECT_ERR : 0);
+        res = socketAction(fds[i].fd, ev);
+    }
+#else
+    errMsg = "waiting for socket events is not supported on Windows, use sockets()/socketAction()";
+    return res;
+#endif
+    if(res == CURLM_OK && getTimeoutMs() == 0) res = socketAction(CURL_SOCKET_TIMEOUT, 0);
+    return res;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////// Functions ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Fails if a performAsync() transfer is running on `curl`, since it must not be touched meanwhile
+bool checkNotAsyncBusy(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl)
+{
+    if(!curl->isAsyncBusy()) return true;
+    vm.fail(loc, "cannot use the curl handle while an async transfer is running on it");
+    return false;
+}
+
+// Fails if `curl` is in a CurlMulti, since its transfer state is bound to the multi handle then
+bool checkNotInMulti(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl)
+{
+    if(!curl->getMulti()) return true;
+    vm.fail(loc, "cannot use the curl handle while it is in a multi handle, remove it first");
+    return false;
+}
+
+FERAL_FUNC(feralCurlGlobalTrace, 1, false,
+           "  fn(trace) -> Int\n"
+           "Sets the global `trace` config for the curl library.")
+{
+    EXPECT(VarStr, args[1], "trace config");
+    int res = curl_global_trace(as<VarStr>(args[1])->getVal().c_str());
+    return vm.makeVar<VarInt>(loc, res);
+}
+
+// Creates a new easy handle (VarCurl), returns nullptr on failure
+VarCurl *makeCurlEasy(VirtualMachine &vm, ModuleLoc loc)
+{
+    CURL *curl = curl_easy_init();
+    if(!curl) {
+        vm.fail(loc, "failed to run curl_easy_init()");
+        return nullptr;
+    }
+    installEasyCallbacks(curl);
+    return vm.makeVar<VarCurl>(loc, curl);
+}
+
+FERAL_FUNC(
+    feralCurlEasyInit, 0, false,
+    "  fn() -> Curl\n"
+    "Creates and returns a Curl (Easy) instance which can be used to perform network operations.")
+{
+    return makeCurlEasy(vm, loc);
+}
+
+FERAL_FUNC(feralCurlEasyReset, 0, false,
+           "  var.fn() -> Nil\n"
+           "Resets all the options and callbacks of the Curl `var` to their initial state.\n"
+           "Its live connections, DNS cache, and TLS session cache are kept.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    curl->reset(vm);
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlEasyClone, 0, false,
+           "  var.fn() -> Curl\n"
+           "Creates and returns a new Curl (Easy) handle with all the options, callbacks (and "
+           "their arguments), write/read targets, string lists, and share handle of the Curl "
+           "`var`, in a single call.\n"
+           "This is meant for spawning per-request handles from a preconfigured template.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    return curl->clone(vm, loc);
+}
+
+FERAL_FUNC(feralCurlSListInit, 1, false,
+           "  fn(data) -> CurlSList\n"
+           "Creates and returns a prebuilt string list from `data`, which can be a string (single "
+           "item), a vector (an item per element), or a map (an item per `key: value` pair).\n"
+           "It can be set as a string list option (such as OPT_HTTPHEADER) of any number of Curl "
+           "handles, any number of times, without being rebuilt.")
+{
+    curl_slist *lst = createSList(vm, loc, args[1]);
+    if(!lst) return nullptr;
+    return vm.makeVar<VarCurlSList>(loc, lst);
+}
+
+FERAL_FUNC(feralCurlPoolInit, 1, false,
+           "  fn(maxHandles) -> CurlPool\n"
+           "Creates and returns a CurlPool instance which keeps up to `maxHandles` released Curl "
+           "(Easy) handles for reuse.")
+{
+    EXPECT(VarInt, args[1], "max handles");
+    return vm.makeVar<VarCurlPool>(loc, as<VarInt>(args[1])->getVal());
+}
+
+FERAL_FUNC(feralCurlPoolAcquire, 0, false,
+           "  var.fn() -> Curl\n"
+           "Returns an idle Curl (Easy) handle from the CurlPool `var`, or a new one if there is "
+           "none.\n"
+           "The pooled handles are reset, but keep their live connections, DNS cache, and TLS "
+           "session cache.\n"
+           "The handle belongs to the caller, like one from `newEasy()`, and goes back to the "
+           "pool only if it is released.")
+{
+    VarCurl *curl = as<VarCurlPool>(args[0])->acquire();
+    if(curl) return curl;
+    return makeCurlEasy(vm, loc);
+}
+
+FERAL_FUNC(feralCurlPoolRelease, 1, false,
+           "  var.fn(curl) -> Nil\n"
+           "Resets the Curl (Easy) handle `curl` and gives it back to the CurlPool `var` for "
+           "reuse, unless the pool is full (`curl` is left as is then).\n"
+           "`curl` must not be used by the caller after this.")
+{
+    EXPECT(VarCurl, args[1], "curl easy handle");
+    VarCurl *curl = as<VarCurl>(args[1]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    as<VarCurlPool>(args[0])->release(vm, curl);
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlRateLimitInit, 2, false,
+           "  fn(bytesPerSec, burst) -> CurlRateLimit\n"
+           "Creates and returns a CurlRateLimit, a token bucket which caps the total rate of all "
+           "the transfers it is set on (see `setRateLimit()`) to `bytesPerSec` (unlimited if 0), "
+           "after an initial `burst` of bytes (bytesPerSec / 10, at least 16 KB, if 0).")
+{
+    EXPECT(VarInt, args[1], "bytes per second");
+    EXPECT(VarInt, args[2], "burst in bytes");
+    int64_t bytesPerSec = as<VarInt>(args[1])->getVal();
+    int64_t burst       = as<VarInt>(args[2])->getVal();
+    if(bytesPerSec < 0 || burst < 0) {
+        vm.fail(loc, "expected the rate and burst to be positive, or 0");
+        return nullptr;
+    }
+    return vm.makeVar<VarCurlRateLimit>(loc, bytesPerSec, burst);
+}
+
+FERAL_FUNC(feralCurlRateLimitSetRate, 2, false,
+           "  var.fn(bytesPerSec, burst) -> Nil\n"
+           "Changes the rate and burst of the CurlRateLimit `var`, taking effect on all of its "
+           "transfers right away.")
+{
+    EXPECT(VarInt, args[1], "bytes per second");
+    EXPECT(VarInt, args[2], "burst in bytes");
+    int64_t bytesPerSec = as<VarInt>(args[1])->getVal();
+    int64_t burst       = as<VarInt>(args[2])->getVal();
+    if(bytesPerSec < 0 || burst < 0) {
+        vm.fail(loc, "expected the rate and burst to be positive, or 0");
+        return nullptr;
+    }
+    as<VarCurlRateLimit>(args[0])->setRate(bytesPerSec, burst);
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlRateLimitGetRate, 0, false,
+           "  var.fn() -> Int\n"
+           "Returns the rate of the CurlRateLimit `var`, in bytes per second.")
+{
+    return vm.makeVar<VarInt>(loc, as<VarCurlRateLimit>(args[0])->getRate());
+}
+
+FERAL_FUNC(feralCurlEasySetRateLimit, 2, false,
+           "  var.fn(recvLimit, sendLimit) -> Nil\n"
+           "Sets the CurlRateLimit (or nil, for no limit) of the data received and the data sent "
+           "by the Curl `var` - a CurlRateLimit can be set on any number of handles (in any "
+           "direction), which then share its rate.\n"
+           "The limit is enforced in the native write and read callbacks: `perform()` and "
+           "`performAsync()` wait, while the transfers of a CurlMulti are paused (and resumed by "
+           "`perform()`, `waitEvents()`, and `socketAction(SOCKET_TIMEOUT, 0)`), so that the other "
+           "transfers keep going.")
+{
+    if(!args[1]->is<VarNil>()) EXPECT(VarCurlRateLimit, args[1], "receive rate limit, or nil");
+    if(!args[2]->is<VarNil>()) EXPECT(VarCurlRateLimit, args[2], "send rate limit, or nil");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    auto toLimit = [](Var *v) { return v->is<VarNil>() ? nullptr : as<VarCurlRateLimit>(v); };
+    curl->setRateLimits(vm, toLimit(args[1]), toLimit(args[2]));
+    return vm.getNil();
+}
+
+// Performs the transfer of `curl` on this thread - through its cache, if it has one and the
+// request is a GET - and sets res to its result
+// Returns false if a Feral callback failed
+bool performEasy(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl, CURLcode &res)
+{
+    CurlCallbackData cbdata(loc, vm, curl);
+    curl->prepareTransfer(&cbdata);
+    if(curl->getCache() && curl->getMethod() == "GET") {
+        String url = curl->getRequestUrl();
+        if(!url.empty()) return curl->getCache()->perform(cbdata, url, res);
+    }
+    res = curl_easy_perform(curl->getVal());
+    recordTransferStats(curl->getVal(), res);
+    return curl->finishTransfer(vm, loc);
+}
+
+FERAL_FUNC(feralCurlCacheInit, 3, false,
+           "  fn(dir, keyHeaders, maxBytes) -> CurlCache\n"
+           "Creates and returns a CurlCache, an HTTP response cache stored in the directory `dir` "
+           "(created if needed), for the Curl handles it is set on (see `setCache()`).\n"
+           "Responses are keyed by the method and URL of their request, the values of its "
+           "headers named in the vector `keyHeaders` (case insensitive), and the values of the "
+           "ones named in the Vary of the response. Only the latest response is kept for a "
+           "method, URL, and `keyHeaders`.\n"
+           "The cache is pruned when it is created, and before storing a body which would make "
+           "the stored ones take more than `maxBytes` (see `prune()`).")
+{
+    EXPECT(VarStr, args[1], "cache directory");
+    EXPECT(VarVec, args[2], "names of the request headers in the key");
+    EXPECT(VarInt, args[3], "max size of the stored bodies");
+    if(as<VarInt>(args[3])->getVal() <= 0) {
+        vm.fail(loc, "expected the max size of the stored bodies to be positive");
+        return nullptr;
+    }
+    Vector<String> keyHeaders;
+    for(auto &name : as<VarVec>(args[2])->getVal()) {
+        if(!name->is<VarStr>()) {
+            vm.fail(loc, "expected the request header names to be strings");
+            return nullptr;
+        }
+        keyHeaders.push_back(as<VarStr>(name)->getVal());
+    }
+    VarCurlCache *res = vm.makeVar<VarCurlCache>(loc, as<VarStr>(args[1])->getVal(), keyHeaders,
+                                                 as<VarInt>(args[3])->getVal());
+    String err;
+    if(!res->init(err)) {
+        vm.fail(loc, "failed to create cache directory: ", err);
+        vm.decVarRef(res);
+        return nullptr;
+    }
+    return res;
+}
+
+FERAL_FUNC(feralCurlCachePrune, 0, false,
+           "  var.fn() -> Nil\n"
+           "Removes the entries of the CurlCache `var` which have been stale for more than a week, "
+           "then the least recently stored or revalidated ones until its bodies take at most 3/4 "
+           "of its max size (if they take more than the max size), and then the bodies and "
+           "temporary files (left over for a day) which are no longer used.\n"
+           "It is done automatically, but may be worth doing at times in a long running process.")
+{
+    as<VarCurlCache>(args[0])->prune();
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlEasySetCache, 1, false,
+           "  var.fn(cache) -> Nil\n"
+           "Sets the CurlCache (or nil, for none) through which `perform()` and `performJson()` "
+           "make the GET requests of the Curl `var`. A fresh stored response is used without any "
+           "request, while a stale one is revalidated with `If-None-Match`/`If-Modified-Since` "
+           "(from its ETag/Last-Modified), and used again if the server replies 304 Not "
+           "Modified.\n"
+           "Responses stay fresh for their Cache-Control `s-maxage` or `max-age` (or until their "
+           "Expires), and `no-cache` ones are always revalidated. As the cache can be shared, "
+           "`no-store`, `private`, and `Vary: *` responses are not stored, and neither are the "
+           "responses to requests with credentials (Authorization or Cookie headers, HTTP "
+           "authentication, OPT_COOKIE, or any cookies in the cookie engine), unless they are "
+           "`public`, `s-maxage`, or `must-revalidate`. The stored bodies are memory mapped when "
+           "they are used.\n"
+           "A Curl with a cache cannot be used with `performAsync()` or a CurlMulti.")
+{
+    if(!args[1]->is<VarNil>()) EXPECT(VarCurlCache, args[1], "curl cache, or nil");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    curl->setCache(vm, args[1]->is<VarNil>() ? nullptr : as<VarCurlCache>(args[1]));
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlEasyGetCacheStatus, 0, false,
+           "  var.fn() -> Str\n"
+           "Returns how the last transfer of the Curl `var` was served by its cache: `hit` (from "
+           "the cache, without any request), `revalidated` (from the cache, after a 304 Not "
+           "Modified), `miss` (from the network), or `none` (not through the cache).\n"
+           "The response info (such as INFO_RESPONSE_CODE) is only updated by a request, but "
+           "`getHeaders()` always returns the headers of the response used.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    const char *status = "none";
+    switch(curl->getCacheStatus()) {
+    case CurlCacheStatus::MISS: status = "miss"; break;
+    case CurlCacheStatus::HIT: status = "hit"; break;
+    case CurlCacheStatus::REVALIDATED: status = "revalidated"; break;
+    case CurlCacheStatus::NONE: break;
+    }
+    return vm.makeVar<VarStr>(loc, status);
+}
+
+FERAL_FUNC(feralCurlEasyPerform, 0, false,
+           "  var.fn() -> Int\n"
+           "Performs the required operations on the Curl object `var` and returns the status code "
+           "of the finished operation.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    CURLcode res = CURLE_OK;
+    if(!performEasy(vm, loc, curl, res)) return nullptr;
+    return vm.makeVar<VarInt>(loc, res);
+}
+
+// Returns the value decoded by the JSON parser of `curl`, and frees the parser's data
+Var *takeJsonResponse(VirtualMachine &vm, ModuleLoc loc, VarCurl *curl)
+{
+    if(curl->getWriteMode() != CurlWriteMode::JSON) {
+        vm.fail(loc, "the Curl handle is not in JSON mode, see setJsonResponse()");
+        return nullptr;
+    }
+    CurlJsonParser &parser = curl->getJsonParser();
+    // only the responses which cannot have a body decode to nil
+    if(parser.isEmpty()) {
+        long code = 0;
+        curl_easy_getinfo(curl->getVal(), CURLINFO_RESPONSE_CODE, &code);
+        if(code == 204 || code == 304) return vm.getNil();
+    }
+    if(!parser.finish()) {
+        vm.fail(loc, "failed to decode JSON response: ", parser.getError());
+        parser.reset();
+        return nullptr;
+    }
+    Var *res = parser.toVar(vm, loc);
+    parser.reset();
+    return res;
+}
+
+FERAL_FUNC(feralCurlEasyPerformJson, 0, false,
+           "  var.fn() -> Map | Vec | Str | Int | Flt | Bool | Nil\n"
+           "Switches the Curl object `var` to JSON mode (see `setJsonResponse()`), performs the "
+           "transfer, and returns the decoded response body.\n"
+           "Fails if the transfer fails, or if the body is not valid JSON (set OPT_FAILONERROR to "
+           "fail on HTTP errors as well). A 204 or 304 response without a body returns nil.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    curl->setWriteJson(vm, true);
+    CURLcode res = CURLE_OK;
+    if(!performEasy(vm, loc, curl, res)) return nullptr;
+    if(res != CURLE_OK) {
+        vm.fail(loc, "failed to perform transfer: ", curl_easy_strerror(res));
+        return nullptr;
+    }
+    return takeJsonResponse(vm, loc, curl);
+}
+
+FERAL_FUNC(feralCurlEasyPerformAsync, 0, false,
+           "  var.fn() -> CurlFuture\n"
+           "Starts performing the required operations on the Curl object `var` on a native worker "
+           "thread, and returns a CurlFuture which is used to wait for the result.\n"
+           "The Feral write and progress callbacks are called on this thread, from within the "
+           "CurlFuture's `wait()` and `isDone()`; the native write modes need neither.\n"
+           "`var` cannot be used until the transfer is done, and the transfer is aborted if the "
+           "CurlFuture is destroyed before that.\n"
+           "Fails if `var` is attached to a CurlShare which shares the connection pool (such as "
+           "the module-wide `share`), since libcurl does not support that across threads.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl) || !checkNotInMulti(vm, loc, curl)) return nullptr;
+    if(curl->getReadMode() == CurlReadMode::FERAL_FN) {
+        vm.fail(loc, "cannot perform asynchronously with a Feral read callback,"
+                     " use a native read source (OPT_READDATA) instead");
+        return nullptr;
+    }
+    if(curl->getHeaderCB()) {
+        vm.fail(loc, "cannot perform asynchronously with a Feral header callback,"
+                     " use getHeaders() after the transfer instead");
+        return nullptr;
+    }
+    if(curl->getCache()) {
+        vm.fail(loc, "cannot perform asynchronously with a cache, use perform() instead");
+        return nullptr;
+    }
+    if(curl->getShare() && curl->getShare()->sharesConnections()) {
+        vm.fail(loc, "cannot perform asynchronously with a CurlShare which shares the connection"
+                     " pool (LOCK_DATA_CONNECT), as libcurl does not support it across threads");
+        return nullptr;
+    }
+    std::shared_ptr<CurlAsyncState> state = std::make_shared<CurlAsyncState>(loc, vm, curl);
+    curl->prepareTransfer(&state->cbdata);
+    // the progress callback is what sees a cancellation while connecting or stalled
+    curl_easy_setopt(curl->getVal(), CURLOPT_NOPROGRESS, 0L);
+    curl->setAsyncBusy(true);
+    VarCurlFuture *res = vm.makeVar<VarCurlFuture>(loc, curl, state);
+    curlWorkerPool.submit([state]() {
+        VarCurl *curl   = state->cbdata.curl;
+        CURLcode result = curl_easy_perform(curl->getVal());
+        curl_easy_setopt(curl->getVal(), CURLOPT_NOPROGRESS, (long)curl->isNoProgress());
+        recordTransferStats(curl->getVal(), result);
+        std::lock_guard<std::mutex> lock(state->mtx);
+        state->result = result;
+        state->done   = true;
+        state->cv.notify_all();
+    });
+    return res;
+}
+
+FERAL_FUNC(feralCurlFutureWait, 1, false,
+           "  var.fn(timeoutMs) -> Int | Nil\n"
+           "Waits for up to `timeoutMs` milliseconds (forever if negative) for the transfer of the "
+           "CurlFuture `var` to finish, while calling the Feral callbacks with the data received "
+           "meanwhile.\n"
+           "Returns the status code of the finished transfer, or nil if it is still running.")
+{
+    EXPECT(VarInt, args[1], "timeout in milliseconds");
+    VarCurlFuture *future = as<VarCurlFuture>(args[0]);
+    bool isDone           = false;
+    if(!future->wait(vm, loc, as<VarInt>(args[1])->getVal(), isDone)) return nullptr;
+    if(!isDone) return vm.getNil();
+    return vm.makeVar<VarInt>(loc, future->getResult());
+}
+
+FERAL_FUNC(feralCurlFutureIsDone, 0, false,
+           "  var.fn() -> Bool\n"
+           "Calls the Feral callbacks with the data received so far by the transfer of the "
+           "CurlFuture `var`, without waiting, and returns whether the transfer is finished.")
+{
+    VarCurlFuture *future = as<VarCurlFuture>(args[0]);
+    bool isDone           = false;
+    if(!future->wait(vm, loc, 0, isDone)) return nullptr;
+    return vm.makeVar<VarBool>(loc, isDone);
+}
+
+FERAL_FUNC(feralCurlEasyStrErrFromInt, 1, false,
+           "  fn(errCode) -> Str\n"
+           "Returns the string representation of the error code `errCode`.")
+{
+    EXPECT(VarInt, args[1], "error code");
+    CURLcode code = (CURLcode)as<VarInt>(args[1])->getVal();
+    return vm.makeVar<VarStr>(loc, curl_easy_strerror(code));
+}
+
+FERAL_FUNC(feralCurlStats, 0, false,
+           "  fn() -> Map\n"
+           "Returns the statistics of all the transfers finished by the module (in any thread) "
+           "since it was loaded or since `resetStats()` - `requests`, `errors` (a map of the "
+           "CURLcode to its count), `bytesIn`, `bytesOut`, `connectionsNew` and "
+           "`connectionsReused` (the number of transfers which made a new connection, or reused "
+           "a live one), `connectionReuseRatio`, and the latency histograms `connectTime`, "
+           "`firstByteTime`, and `totalTime`.\n"
+           "Each histogram is a map of `count`, `sum`, `min`, `max`, `mean`, `p50`, `p90`, "
+           "`p99`, and `p999`, all in microseconds, over all the transfers, failed ones included "
+           "(`connectTime` only counts the transfers which made a new connection, and "
+           "`firstByteTime` the ones which received a response).")
+{
+    VarMap *res = vm.makeVar<VarMap>(loc, 10, false);
+    res->insert(vm, "requests",
+                vm.makeVar<VarInt>(loc, curlStats.requests.load(std::memory_order_relaxed)),
+                true);
+    VarMap *errors = vm.makeVar<VarMap>(loc, 0, false);
+    for(int i = 1; i < CURL_LAST; ++i) {
+        uint64_t count = curlStats.errors[i].load(std::memory_order_relaxed);
+        if(count == 0) continue;
+        errors->insert(vm, std::to_string(i), vm.makeVar<VarInt>(loc, count), true);
+    }
+    res->insert(vm, "errors", errors, true);
+    res->insert(vm, "bytesIn",
+                vm.makeVar<VarInt>(loc, curlStats.bytesIn.load(std::memory_order_relaxed)), true);
+    res->insert(vm, "bytesOut",
+                vm.makeVar<VarInt>(loc, curlStats.bytesOut.load(std::memory_order_relaxed)),
+                true);
+    uint64_t connNew    = curlStats.connectionsNew.load(std::memory_order_relaxed);
+    uint64_t connReused = curlStats.connectionsReused.load(std::memory_order_relaxed);
+    res->insert(vm, "connectionsNew", vm.makeVar<VarInt>(loc, connNew), true);
+    res->insert(vm, "connectionsReused", vm.makeVar<VarInt>(loc, connReused), true);
+    res->insert(vm, "connectionReuseRatio",
+                vm.makeVar<VarFlt>(loc, connNew + connReused > 0
+                                            ? (double)connReused / (connNew + connReused)
+                                            : 0.0),
+                true);
+    res->insert(vm, "connectTime", curlStats.connectTime.toMap(vm, loc), true);
+    res->insert(vm, "firstByteTime", curlStats.firstByteTime.toMap(vm, loc), true);
+    res->insert(vm, "totalTime", curlStats.totalTime.toMap(vm, loc), true);
+    return res;
+}
+
+FERAL_FUNC(feralCurlResetStats, 0, false,
+           "  fn() -> Nil\n"
+           "Resets all the transfer statistics of the module to zero.")
+{
+    curlStats.reset();
+    return vm.getNil();
+}
+
+// A single transfer of fetchAll(), which runs natively without involving the VM
+struct CurlFetchJob
+{
+    String url;
+    String file; // the response body is written to this file, if set
+    String method;
+    String reqBody;
+    String respBody;
+    curl_slist *headers; // owned, nullptr to use the default headers
+    String userAgent;
+    FILE *out;
+    CURL *easy;
+    long timeoutMs;
+    long httpVersion;
+    bool hasReqBody;
+    bool followRedirects;
+    CURLcode result;
+    long status;
+    curl_off_t connectTime;
+    curl_off_t firstByteTime;
+    curl_off_t totalTime;
+    curl_off_t sizeDownload;
+
+    CurlFetchJob()
+        : headers(nullptr), out(nullptr), easy(nullptr), timeoutMs(0),
+          httpVersion(CURL_HTTP_VERSION_NONE), hasReqBody(false),
+          followRedirects(true), result(CURLE_OK), status(0), connectTime(0), firstByteTime(0),
+          totalTime(0), sizeDownload(0)
+    {}
+};
+
+size_t curlFetchWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    CurlFetchJob &job = *(CurlFetchJob *)userdata;
+    if(job.out) return fwrite(ptr, 1, size * nmemb, job.out);
+    // an exception must not go through libcurl - returning 0 fails the transfer instead
+    try {
+        job.respBody.append(ptr, size * nmemb);
+    } catch(const std::bad_alloc &) {
+        return 0;
+    }
+    return size * nmemb;
+}
+
+// Applies the fetchAll() options in `opts` to `job`
+bool parseFetchOpts(VirtualMachine &vm, ModuleLoc loc, VarMap *opts, CurlFetchJob &job)
+{
+    for(auto &o : opts->getVal()) {
+        StringRef key = o.first;
+        Var *val      = o.second;
+        if(key == "headers") {
+            curl_slist *lst = createSList(vm, loc, val);
+            if(!lst) return false;
+            curl_slist_free_all(job.headers);
+            job.headers = lst;
+        } else if(key == "timeoutMs" || key == "httpVersion" || key == "followRedirects") {
+            if(!val->is<VarInt>() && !val->is<VarBool>()) {
+                vm.fail(loc, "expected an int or bool value for fetch option: ", key);
+                return false;
+            }
+            long v = val->is<VarInt>() ? as<VarInt>(val)->getVal() : as<VarBool>(val)->getVal();
+            if(key == "timeoutMs") job.timeoutMs = v;
+            else if(key == "httpVersion") job.httpVersion = v;
+            else job.followRedirects = v;
+        } else if(key == "url" || key == "file" || key == "method" || key == "body" ||
+                  key == "userAgent")
+        {
+            if(!val->is<VarStr>()) {
+                vm.fail(loc, "expected a string value for fetch option: ", key);
+                return false;
+            }
+            const String &v = as<VarStr>(val)->getVal();
+            if(key == "url") job.url = v;
+            else if(key == "file") job.file = v;
+            else if(key == "method") job.method = v;
+            else if(key == "userAgent") job.userAgent = v;
+            else {
+                job.reqBody    = v;
+                job.hasReqBody = true;
+            }
+        } else {
+            vm.fail(loc, "unknown fetch option: ", key);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Creates the easy handle for `job` and adds it to `multi`, the job fails if that is not possible
+bool startFetchJob(CURLM *multi, CurlFetchJob &job, curl_slist *defHeaders)
+{
+    if(!job.file.empty() && !(job.out = fopen(job.file.c_str(), "wb"))) {
+        job.result = CURLE_WRITE_ERROR;
+        return false;
+    }
+    // the job is not finished by finishFetchJob() if it never started, so its file is closed here
+    auto fail = [&job]() {
+        if(job.out) fclose(job.out);
+        job.out    = nullptr;
+        job.result = CURLE_FAILED_INIT;
+        return false;
+    };
+    if(!(job.easy = curl_easy_init())) return fail();
+    curl_easy_setopt(job.easy, CURLOPT_URL, job.url.c_str());
+    curl_easy_setopt(job.easy, CURLOPT_PRIVATE, &job);
+    curl_easy_setopt(job.easy, CURLOPT_WRITEFUNCTION, curlFetchWriteCallback);
+    curl_easy_setopt(job.easy, CURLOPT_WRITEDATA, &job);
+    curl_easy_setopt(job.easy, CURLOPT_FOLLOWLOCATION, (long)job.followRedirects);
+    if(job.timeoutMs > 0) curl_easy_setopt(job.easy, CURLOPT_TIMEOUT_MS, job.timeoutMs);
+    // multiplex the transfers to the same origin over one HTTP/2 connection, where possible
+    curl_easy_setopt(job.easy, CURLOPT_PIPEWAIT, 1L);
+    if(job.httpVersion != CURL_HTTP_VERSION_NONE) {
+        curl_easy_setopt(job.easy, CURLOPT_HTTP_VERSION, job.httpVersion);
+    }
+    if(job.headers || defHeaders) {
+        curl_easy_setopt(job.easy, CURLOPT_HTTPHEADER, job.headers ? job.headers : defHeaders);
+    }
+    if(!job.userAgent.empty()) curl_easy_setopt(job.easy, CURLOPT_USERAGENT, job.userAgent.c_str());
+    if(job.hasReqBody) {
+        curl_easy_setopt(job.easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)job.reqBody.size());
+        curl_easy_setopt(job.easy, CURLOPT_POSTFIELDS, job.reqBody.c_str());
+    }
+    // a custom HEAD would still wait for the body, which never comes
+    if(job.method == "HEAD") {
+        curl_easy_setopt(job.easy, CURLOPT_NOBODY, 1L);
+    } else if(!job.method.empty()) {
+        curl_easy_setopt(job.easy, CURLOPT_CUSTOMREQUEST, job.method.c_str());
+    }
+    CURLMcode res = curl_multi_add_handle(multi, job.easy);
+    if(res != CURLM_OK) {
+        curl_easy_cleanup(job.easy);
+        job.easy = nullptr;
+        return fail();
+    }
+    return true;
+}
+
+// Collects the result of the finished `job` and frees its transfer resources
+void finishFetchJob(CURLM *multi, CurlFetchJob &job, CURLcode result)
+{
+    job.result = result;
+    curl_easy_getinfo(job.easy, CURLINFO_RESPONSE_CODE, &job.status);
+    curl_easy_getinfo(job.easy, CURLINFO_CONNECT_TIME_T, &job.connectTime);
+    curl_easy_getinfo(job.easy, CURLINFO_STARTTRANSFER_TIME_T, &job.firstByteTime);
+    curl_easy_getinfo(job.easy, CURLINFO_TOTAL_TIME_T, &job.totalTime);
+    curl_easy_getinfo(job.easy, CURLINFO_SIZE_DOWNLOAD_T, &job.sizeDownload);
+    recordTransferStats(job.easy, result);
+    curl_multi_remove_handle(multi, job.easy);
+    curl_easy_cleanup(job.easy);
+    job.easy = nullptr;
+    if(job.out && fclose(job.out) != 0 && job.result == CURLE_OK) job.result = CURLE_WRITE_ERROR;
+    job.out = nullptr;
+}
+
+FERAL_FUNC(feralCurlFetchAll, 3, false,
+           "  fn(urls, concurrency, opts) -> Vec<Map>\n"
+           "Fetches all the `urls` natively, running up to `concurrency` transfers at a time on a "
+           "multi handle (which shares the connections, DNS cache, and TLS sessions among them), "
+           "and returns a vector with the result of each url, in the same order.\n"
+           "Each url is either a string, or a map containing the `url` and the options for it, "
+           "which override the default options given in the map `opts` (or nil) - `file` (path "
+           "to write the body to, instead of collecting it in memory), `method`, `body`, "
+           "`headers` (as with OPT_HTTPHEADER), `userAgent`, `timeoutMs`, `httpVersion` "
+           "(HTTP_VERSION_*), and "
+           "`followRedirects` (true by default).\n"
+           "Each result is a map of `url`, `result` (CURLcode), `status` (response code), `body` "
+           "or `file`, and `connectTime`, `firstByteTime`, `totalTime` (microseconds), and "
+           "`sizeDownload`.")
+{
+    EXPECT(VarVec, args[1], "vector of urls, or maps of url and options");
+    EXPECT(VarInt, args[2], "max concurrent transfers");
+    if(!args[3]->is<VarNil>()) EXPECT(VarMap, args[3], "map of default options, or nil");
+    Vector<Var *> &urls = as<VarVec>(args[1])->getVal();
+    size_t concurrency  = std::max<int64_t>(1, as<VarInt>(args[2])->getVal());
+
+    CurlFetchJob defaults;
+    Vector<CurlFetchJob> jobs(urls.size());
+    auto cleanup = [&]() {
+        curl_slist_free_all(defaults.headers);
+        for(auto &job : jobs) curl_slist_free_all(job.headers);
+    };
+    if(args[3]->is<VarMap>() && !parseFetchOpts(vm, loc, as<VarMap>(args[3]), defaults)) {
+        cleanup();
+        return nullptr;
+    }
+    for(size_t i = 0; i < urls.size(); ++i) {
+        jobs[i]         = defaults;
+        jobs[i].headers = nullptr;
+        if(urls[i]->is<VarStr>()) {
+            jobs[i].url = as<VarStr>(urls[i])->getVal();
+        } else if(!urls[i]->is<VarMap>()) {
+            vm.fail(loc, "expected each url to be a string or a map of url and options");
+            cleanup();
+            return nullptr;
+        } else if(!parseFetchOpts(vm, loc, as<VarMap>(urls[i]), jobs[i])) {
+            cleanup();
+            return nullptr;
+        }
+        if(jobs[i].url.empty()) {
+            vm.fail(loc, "no url given for the fetch at index: ", i);
+            cleanup();
+            return nullptr;
+        }
+    }
+
+    CURLM *multi = curl_multi_init();
+    if(!multi) {
+        vm.fail(loc, "failed to create multi handle for fetching");
+        cleanup();
+        return nullptr;
+    }
+    size_t next   = 0;
+    size_t active = 0;
+    auto fill     = [&]() {
+        while(next < jobs.size() && active < concurrency) {
+            if(startFetchJob(multi, jobs[next], defaults.headers)) ++active;
+            ++next;
+        }
+    };
+    fill();
+    CURLMcode mres = CURLM_OK;
+    while(active > 0) {
+        int running = 0;
+        if((mres = curl_multi_perform(multi, &running)) != CURLM_OK) break;
+        CURLMsg *msg = nullptr;
+        int msgsLeft = 0;
+        while((msg = curl_multi_info_read(multi, &msgsLeft))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            CurlFetchJob *job = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+            finishFetchJob(multi, *job, msg->data.result);
+            --active;
+        }
+        fill();
+        if(active == 0) break;
+#if CURL_AT_LEAST_VERSION(7, 66, 0)
+        mres = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+        mres = curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+#endif
+        if(mres != CURLM_OK) break;
+    }
+    for(auto &job : jobs) {
+        if(!job.easy) continue;
+        finishFetchJob(multi, job, CURLE_ABORTED_BY_CALLBACK);
+    }
+    curl_multi_cleanup(multi);
+    cleanup();
+    if(mres != CURLM_OK) {
+        vm.fail(loc, "failed to run fetches: ", curl_multi_strerror(mres));
+        return nullptr;
+    }
+
+    VarVec *res = vm.makeVar<VarVec>(loc, jobs.size(), false);
+    for(auto &job : jobs) {
+        VarMap *item = vm.makeVar<VarMap>(loc, 8, false);
+        item->insert(vm, "url", vm.makeVar<VarStr>(loc, job.url), true);
+        item->insert(vm, "result", vm.makeVar<VarInt>(loc, job.result), true);
+        item->insert(vm, "status", vm.makeVar<VarInt>(loc, job.status), true);
+        if(job.file.empty()) {
+            item->insert(vm, "body", vm.makeVar<VarStr>(loc, std::move(job.respBody)), true);
+        } else {
+            item->insert(vm, "file", vm.makeVar<VarStr>(loc, job.file), true);
+        }
+        item->insert(vm, "connectTime", vm.makeVar<VarInt>(loc, job.connectTime), true);
+        item->insert(vm, "firstByteTime", vm.makeVar<VarInt>(loc, job.firstByteTime), true);
+        item->insert(vm, "totalTime", vm.makeVar<VarInt>(loc, job.totalTime), true);
+        item->insert(vm, "sizeDownload", vm.makeVar<VarInt>(loc, job.sizeDownload), true);
+        res->push(vm, item, true);
+    }
+    return res;
+}
+
+// A byte range of a downloadSegmented() transfer, written at its offset in the output file
+struct CurlSegment
+{
+    curl_off_t start;
+    curl_off_t end; // inclusive, -1 when the size of the file is unknown
+    curl_off_t done;
+    CURL *easy;
+    int fd;
+    int tries;
+    bool ranged;  // the request asks for a byte range, so the response must be a 206
+    bool checked; // the response code has been checked
+    bool failed;
+};
+
+// What a HEAD request tells about the file to download
+struct CurlRemoteFile
+{
+    curl_off_t size; // -1 if unknown
+    String validator; // ETag, or Last-Modified
+    bool acceptsRanges;
+};
+
+size_t curlHeadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    CurlRemoteFile &remote = *(CurlRemoteFile *)userdata;
+    size_t len             = size * nitems;
+    StringRef line(buffer, len);
+    while(!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.remove_suffix(1);
+    // a new response (after a redirect) starts over
+    if(line.starts_with("HTTP/")) {
+        remote.validator.clear();
+        remote.acceptsRanges = false;
+        return len;
+    }
+    size_t colon = line.find(':');
+    if(colon == StringRef::npos) return len;
+    String name(line.substr(0, colon));
+    for(auto &c : name) c = std::tolower((unsigned char)c);
+    size_t valStart = line.find_first_not_of(' ', colon + 1);
+    StringRef val   = valStart == StringRef::npos ? StringRef() : line.substr(valStart);
+    if(name == "accept-ranges") remote.acceptsRanges = val == "bytes";
+    else if(name == "etag") remote.validator = val;
+    else if(name == "last-modified" && remote.validator.empty()) remote.validator = val;
+    return len;
+}
+
+size_t curlSegmentWriteCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    CurlSegment &seg = *(CurlSegment *)userdata;
+    size_t len       = size * nmemb;
+    if(!seg.checked) {
+        long status = 0;
+        curl_easy_getinfo(seg.easy, CURLINFO_RESPONSE_CODE, &status);
+        // a 200 to a range request carries the whole file, which does not belong at this offset
+        if(seg.ranged && status != 206) return 0;
+        seg.checked = true;
+    }
+    if(seg.end >= 0 && seg.start + seg.done + (curl_off_t)len > seg.end + 1) return 0;
+#if defined(_WIN32)
+    return 0;
+#else
+    size_t written = 0;
+    while(written < len) {
+        ssize_t res = pwrite(seg.fd, ptr + written, len - written, seg.start + seg.done);
+        if(res < 0 && errno == EINTR) continue;
+        if(res <= 0) break;
+        written += res;
+        seg.done += res;
+    }
+    return written;
+#endif
+}
+
+#if !defined(_WIN32)
+// Sets the size of the file `fd` to `size`, and allocates its blocks up front where the file
+// system supports it (the file is sparse otherwise), returns false (with errno set) on failure
+bool preallocateFile(int fd, curl_off_t size)
+{
+    if(ftruncate(fd, size) < 0) return false;
+#if defined(__linux__) || defined(__FreeBSD__)
+    int err = size > 0 ? posix_fallocate(fd, 0, size) : 0;
+    // EINVAL or EOPNOTSUPP mean that the file system cannot allocate ahead, which is not an error
+    if(err != 0 && err != EINVAL && err != EOPNOTSUPP) {
+        errno = err;
+        return false;
+    }
+#endif
+    return true;
+}
+#endif
+
+// Finds the size, validator, and range support of `url` with a HEAD request
+CURLcode headRemoteFile(const String &url, CurlRemoteFile &remote)
+{
+    remote.size          = -1;
+    remote.acceptsRanges = false;
+    CURL *easy           = curl_easy_init();
+    if(!easy) return CURLE_FAILED_INIT;
+    curl_easy_setopt(easy, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(easy, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, curlHeadHeaderCallback);
+    curl_easy_setopt(easy, CURLOPT_HEADERDATA, &remote);
+    CURLcode res = curl_easy_perform(easy);
+    if(res == CURLE_OK) {
+        curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &remote.size);
+    }
+    curl_easy_cleanup(easy);
+    return res;
+}
+
+// The state file of a segmented download is:
+//   <size> <segment count>
+//   <validator>
+//   <start> <end> <done>   (for each segment)
+bool loadSegmentState(const String &statePath, const CurlRemoteFile &remote,
+                      Vector<CurlSegment> &segments)
+{
+    FILE *f = fopen(statePath.c_str(), "r");
+    if(!f) return false;
+    long long size = 0;
+    size_t count   = 0;
+    char line[1024];
+    char validator[1024];
+    // read by lines, as the validator may be empty
+    // there cannot be more segments than bytes, which also bounds what a corrupt file allocates
+    bool ok = fgets(line, sizeof(line), f) && sscanf(line, "%lld %zu", &size, &count) == 2 &&
+              size == remote.size && size > 0 && count > 0 && count <= (size_t)size &&
+              fgets(validator, sizeof(validator), f);
+    if(ok) {
+        StringRef v(validator);
+        if(v.ends_with('\n')) v.remove_suffix(1);
+        // the file has changed on the server, the parts downloaded so far are useless
+        ok = v == remote.validator;
+    }
+    Vector<CurlSegment> loaded;
+    if(ok) loaded.resize(count);
+    for(size_t i = 0; ok && i < count; ++i) {
+        long long start = 0, end = 0, done = 0;
+        // the segments must cover the file exactly, in order, without gaps or overlaps
+        curl_off_t expectedStart = i == 0 ? 0 : loaded[i - 1].end + 1;
+        ok = fgets(line, sizeof(line), f) &&
+             sscanf(line, "%lld %lld %lld", &start, &end, &done) == 3 &&
+             start == expectedStart && start <= end + 1 && end < size && done >= 0 &&
+             done <= end - start + 1 && (i + 1 < count || end == size - 1);
+        loaded[i]       = {};
+        loaded[i].start = start;
+        loaded[i].end   = end;
+        loaded[i].done  = done;
+        // as for a fresh download, a segment which has not started yet must still get a 206
+        loaded[i].ranged = count > 1;
+    }
+    fclose(f);
+    if(ok) segments = std::move(loaded);
+    return ok;
+}
+
+bool saveSegmentState(const String &statePath, const CurlRemoteFile &remote,
+                      const Vector<CurlSegment> &segments)
+{
+    // written to a temporary file first, so that a crash never leaves a truncated state behind
+    String tmpPath = statePath + ".tmp";
+    FILE *f        = fopen(tmpPath.c_str(), "w");
+    if(!f) return false;
+    fprintf(f, "%lld %zu\n%s\n", (long long)remote.size, segments.size(),
+            remote.validator.c_str());
+    for(auto &seg : segments) {
+        fprintf(f, "%lld %lld %lld\n", (long long)seg.start, (long long)seg.end,
+                (long long)seg.done);
+    }
+    if(fclose(f) != 0) return false;
+    return rename(tmpPath.c_str(), statePath.c_str()) == 0;
+}
+
+// Points the easy handle of `seg` at the rest of its range and adds it to `multi`
+bool startSegment(CURLM *multi, CurlSegment &seg, bool canRange)
+{
+    // without ranges, a retry has to start over
+    if(!canRange || seg.end < 0) seg.done = 0;
+    seg.checked = false;
+    seg.ranged  = canRange && seg.end >= 0 && (seg.start + seg.done > 0 || seg.ranged);
+    if(seg.ranged) {
+        String range = std::to_string(seg.start + seg.done) + "-" + std::to_string(seg.end);
+        curl_easy_setopt(seg.easy, CURLOPT_RANGE, range.c_str());
+    }
+    return curl_multi_add_handle(multi, seg.easy) == CURLM_OK;
+}
+
+Var *makeSegmentedResult(VirtualMachine &vm, ModuleLoc loc, CURLcode result, curl_off_t size,
+                         curl_off_t bytes, size_t segments, bool resumed)
+{
+    VarMap *res = vm.makeVar<VarMap>(loc, 5, false);
+    res->insert(vm, "result", vm.makeVar<VarInt>(loc, result), true);
+    res->insert(vm, "size", vm.makeVar<VarInt>(loc, size), true);
+    res->insert(vm, "bytes", vm.makeVar<VarInt>(loc, bytes), true);
+    res->insert(vm, "segments", vm.makeVar<VarInt>(loc, segments), true);
+    res->insert(vm, "resumed", vm.makeVar<VarBool>(loc, resumed), true);
+    return res;
+}
+
+FERAL_FUNC(feralCurlDownloadSegmented, 4, false,
+           "  fn(url, path, segments, retries) -> Map\n"
+           "Downloads `url` to the file at `path` natively, over up to `segments` concurrent "
+           "range requests on a multi handle, each of which writes its part at its offset in the "
+           "file (set to the size found with a HEAD request, and preallocated where the file "
+           "system supports it). Each segment is retried up to `retries` times, resuming from "
+           "where it stopped.\n"
+           "Progress is kept in `<path>.part`, so calling this again after a failure (or a crash) "
+           "resumes the download, as long as the file on the server is unchanged (same size and "
+           "ETag or Last-Modified). The state file is removed once the download is complete.\n"
+           "If the server does not support ranges or HEAD requests, or does not send the size, "
+           "the file is downloaded over a single request.\n"
+           "Returns a map of `result` (CURLcode of the first failure, or E_OK), `size` (-1 if "
+           "unknown), `bytes` (downloaded by this call), `segments`, and `resumed`.")
+{
+    EXPECT(VarStr, args[1], "url to download");
+    EXPECT(VarStr, args[2], "path of the file to download to");
+    EXPECT(VarInt, args[3], "number of segments");
+    EXPECT(VarInt, args[4], "number of retries for each segment");
+#if defined(_WIN32)
+    vm.fail(loc, "segmented downloads are not supported on Windows");
+    return nullptr;
+#else
+    const String &url  = as<VarStr>(args[1])->getVal();
+    const String &path = as<VarStr>(args[2])->getVal();
+    String statePath   = path + ".part";
+    int64_t maxSegs    = std::max<int64_t>(1, as<VarInt>(args[3])->getVal());
+    int retries        = std::max<int64_t>(0, as<VarInt>(args[4])->getVal());
+
+    CurlRemoteFile remote;
+    CURLcode result = CURLE_OK;
+    // a server which refuses the HEAD request (with a 405, for instance) gets a single GET, like
+    // one which does not send the size - if the URL is unusable, that GET fails as well
+    if(headRemoteFile(url, remote) != CURLE_OK) remote = {-1, "", false};
+
+    Vector<CurlSegment> segments;
+    bool canRange = remote.size > 0 && remote.acceptsRanges;
+    bool resumed  = canRange && loadSegmentState(statePath, remote, segments);
+    if(!resumed) {
+        size_t count = 1;
+        if(canRange) {
+            // no point in segments smaller than 1 MB, the requests would cost more than they save
+            count = std::clamp<int64_t>(remote.size / (1024 * 1024), 1, maxSegs);
+        }
+        segments.resize(count);
+        curl_off_t segSize = remote.size > 0 ? remote.size / count : 0;
+        for(size_t i = 0; i < count; ++i) {
+            segments[i]       = {};
+            segments[i].start = i * segSize;
+            segments[i].end   = remote.size < 0            ? -1
+                                : i + 1 == count ? remote.size - 1
+                                                 : (i + 1) * segSize - 1;
+            // resuming an unsegmented download needs range support
+            segments[i].ranged = count > 1;
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if(fd < 0) {
+        vm.fail(loc, "failed to open file ", path, ": ", strerror(errno));
+        return nullptr;
+    }
+    // preallocating avoids fragmenting the file with the out of order writes, and running out of
+    // space halfway through
+    if(remote.size >= 0 && !preallocateFile(fd, remote.size)) {
+        vm.fail(loc, "failed to preallocate file ", path, ": ", strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+
+    CURLM *multi = curl_multi_init();
+    if(!multi) {
+        vm.fail(loc, "failed to create multi handle for downloading");
+        ::close(fd);
+        return nullptr;
+    }
+    curl_off_t doneBefore = 0;
+    size_t active         = 0;
+    for(auto &seg : segments) {
+        doneBefore += seg.done;
+        seg.fd = fd;
+        if(seg.end >= 0 && seg.start + seg.done > seg.end) continue;
+        if(!(seg.easy = curl_easy_init())) {
+            result = CURLE_FAILED_INIT;
+            break;
+        }
+        curl_easy_setopt(seg.easy, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(seg.easy, CURLOPT_PRIVATE, &seg);
+        curl_easy_setopt(seg.easy, CURLOPT_WRITEFUNCTION, curlSegmentWriteCallback);
+        curl_easy_setopt(seg.easy, CURLOPT_WRITEDATA, &seg);
+        curl_easy_setopt(seg.easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(seg.easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(seg.easy, CURLOPT_PIPEWAIT, 1L);
+        if(!startSegment(multi, seg, canRange)) {
+            result = CURLE_FAILED_INIT;
+            break;
+        }
+        ++active;
+    }
+    if(result != CURLE_OK) {
+        for(auto &seg : segments) {
+            if(!seg.easy) continue;
+            curl_multi_remove_handle(multi, seg.easy);
+            curl_easy_cleanup(seg.easy);
+        }
+        curl_multi_cleanup(multi);
+        ::close(fd);
+        vm.fail(loc, "failed to start the download of ", url);
+        return nullptr;
+    }
+
+    using namespace std::chrono;
+    auto lastSave  = steady_clock::now();
+    CURLMcode mres = CURLM_OK;
+    while(active > 0) {
+        int running = 0;
+        if((mres = curl_multi_perform(multi, &running)) != CURLM_OK) break;
+        CURLMsg *msg = nullptr;
+        int msgsLeft = 0;
+        while((msg = curl_multi_info_read(multi, &msgsLeft))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            CurlSegment *seg = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&seg);
+            CURLcode segRes = msg->data.result;
+            recordTransferStats(seg->easy, segRes);
+            curl_multi_remove_handle(multi, seg->easy);
+            // a transfer which ends early without an error is retried like a failed one
+            if(segRes == CURLE_OK && seg->end >= 0 && seg->start + seg->done <= seg->end) {
+                segRes = CURLE_PARTIAL_FILE;
+            }
+            if(segRes != CURLE_OK && seg->tries++ < retries &&
+               startSegment(multi, *seg, canRange))
+            {
+                continue;
+            }
+            if(segRes != CURLE_OK) {
+                seg->failed = true;
+                if(result == CURLE_OK) result = segRes;
+            }
+            --active;
+        }
+        if(active == 0) break;
+        // the progress is saved now and then, so that a crash loses little of it
+        if(canRange && steady_clock::now() - lastSave > seconds(1)) {
+            saveSegmentState(statePath, remote, segments);
+            lastSave = steady_clock::now();
+        }
+#if CURL_AT_LEAST_VERSION(7, 66, 0)
+        mres = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+        mres = curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+#endif
+        if(mres != CURLM_OK) break;
+    }
+    curl_off_t doneAfter = 0;
+    for(auto &seg : segments) {
+        doneAfter += seg.done;
+        if(!seg.easy) continue;
+        curl_multi_remove_handle(multi, seg.easy);
+        curl_easy_cleanup(seg.easy);
+        seg.easy = nullptr;
+    }
+    curl_multi_cleanup(multi);
+    if(mres != CURLM_OK && result == CURLE_OK) result = CURLE_ABORTED_BY_CALLBACK;
+    // the size of an unsegmented download is only known once it is over
+    if(remote.size < 0 && result == CURLE_OK && ftruncate(fd, doneAfter) < 0) {
+        result = CURLE_WRITE_ERROR;
+    }
+    if(::close(fd) < 0 && result == CURLE_OK) result = CURLE_WRITE_ERROR;
+    if(result == CURLE_OK) {
+        remove(statePath.c_str());
+    } else if(canRange) {
+        saveSegmentState(statePath, remote, segments);
+    }
+
+    return makeSegmentedResult(vm, loc, result, remote.size, doneAfter - doneBefore,
+                               segments.size(), resumed);
+#endif
+}
+
+// The connections opened to one url by prewarm()
+struct CurlPrewarmHost
+{
+    String url;
+    CURLcode result;
+    long connections;
+    curl_off_t connectTime; // of the slowest connection setup (TCP and TLS), in microseconds
+};
+
+// Records the result of a finished prewarm() request, and frees its handle - but not its
+// connection, which stays in the connection pool
+void finishPrewarm(CURLM *multi, CURL *easy, CURLcode result)
+{
+    CurlPrewarmHost *host = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&host);
+    long connects          = 0;
+    curl_off_t connectTime = 0, appConnectTime = 0;
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connectTime);
+    curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &appConnectTime);
+    host->connections += connects;
+    host->connectTime = std::max({host->connectTime, connectTime, appConnectTime});
+    if(host->result == CURLE_OK) host->result = result;
+    recordTransferStats(easy, result);
+    curl_multi_remove_handle(multi, easy);
+    curl_easy_cleanup(easy);
+}
+
+FERAL_FUNC(feralCurlPrewarm, 4, false,
+           "  fn(urls, connectionsPerHost, target, timeoutMs) -> Vec<Map>\n"
+           "Opens `connectionsPerHost` connections to each of the `urls` ahead of time (resolving "
+           "the name, and doing the TCP and TLS handshakes), and leaves them idle in the "
+           "connection pool of `target`, so that the first transfers to those hosts skip the "
+           "setup. `target` is either a CurlShare which shares LOCK_DATA_CONNECT (for the Curl "
+           "handles attached to it with OPT_SHARE), or a CurlMulti without any transfers (for "
+           "the Curl handles added to it later). Fails for a CurlShare without LOCK_DATA_CONNECT, "
+           "which has no connection pool to leave the connections in.\n"
+           "Each connection is opened by a HEAD request for its url (`https://` is assumed if it "
+           "has no scheme), as libcurl never hands a connection made with OPT_CONNECT_ONLY over "
+           "to another transfer. They all run concurrently, for up to `timeoutMs` milliseconds "
+           "(0 for no limit).\n"
+           "Returns a vector with a map for each url, in the same order, of `url`, `result` "
+           "(CURLcode of the first failure, or E_OK), `connections` (the number opened), and "
+           "`connectTime` (of the slowest connection setup, in microseconds).")
+{
+    EXPECT(VarVec, args[1], "vector of urls");
+    EXPECT(VarInt, args[2], "connections per host");
+    if(!args[3]->is<VarCurlMulti>()) EXPECT(VarCurlShare, args[3], "curl share or multi handle");
+    EXPECT(VarInt, args[4], "timeout in milliseconds");
+    Vector<Var *> &urls = as<VarVec>(args[1])->getVal();
+    int64_t perHost     = std::max<int64_t>(1, as<VarInt>(args[2])->getVal());
+    long timeoutMs      = std::max<int64_t>(0, as<VarInt>(args[4])->getVal());
+
+    Vector<CurlPrewarmHost> hosts(urls.size());
+    for(size_t i = 0; i < urls.size(); ++i) {
+        if(!urls[i]->is<VarStr>()) {
+            vm.fail(loc, "expected each url to be a string");
+            return nullptr;
+        }
+        hosts[i] = {as<VarStr>(urls[i])->getVal(), CURLE_OK, 0, 0};
+    }
+
+    // a share is warmed up through a temporary multi handle, whose own pool is left unused
+    VarCurlShare *share = args[3]->is<VarCurlShare>() ? as<VarCurlShare>(args[3]) : nullptr;
+    CURLM *multi        = nullptr;
+    if(share) {
+        // otherwise the connections would land in the temporary multi's pool, and be closed
+        if(!share->sharesConnections()) {
+            vm.fail(loc, "cannot prewarm a curl share which does not share the connection pool"
+                         " (LOCK_DATA_CONNECT)");
+            return nullptr;
+        }
+        if(!(multi = curl_multi_init())) {
+            vm.fail(loc, "failed to create multi handle for prewarming");
+            return nullptr;
+        }
+    } else {
+        VarCurlMulti *target = as<VarCurlMulti>(args[3]);
+        if(target->getHandleCount() > 0) {
+            vm.fail(loc, "cannot prewarm a multi handle which has transfers in it,"
+                         " prewarm it before adding them");
+            return nullptr;
+        }
+        multi = target->getVal();
+    }
+
+    Vector<CURL *> easies;
+    for(auto &host : hosts) {
+        for(int64_t i = 0; i < perHost; ++i) {
+            CURL *easy = curl_easy_init();
+            if(!easy) {
+                host.result = CURLE_FAILED_INIT;
+                break;
+            }
+            curl_easy_setopt(easy, CURLOPT_URL, host.url.c_str());
+            curl_easy_setopt(easy, CURLOPT_DEFAULT_PROTOCOL, "https");
+            curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(easy, CURLOPT_PRIVATE, &host);
+            if(timeoutMs > 0) curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, timeoutMs);
+            if(share) curl_easy_setopt(easy, CURLOPT_SHARE, share->getVal());
+            if(curl_multi_add_handle(multi, easy) != CURLM_OK) {
+                curl_easy_cleanup(easy);
+                host.result = CURLE_FAILED_INIT;
+                break;
+            }
+            easies.push_back(easy);
+        }
+    }
+    CURLMcode mres = CURLM_OK;
+    while(!easies.empty()) {
+        int running = 0;
+        if((mres = curl_multi_perform(multi, &running)) != CURLM_OK) break;
+        CURLMsg *msg = nullptr;
+        int msgsLeft = 0;
+        while((msg = curl_multi_info_read(multi, &msgsLeft))) {
+            if(msg->msg != CURLMSG_DONE) continue;
+            CURL *easy = msg->easy_handle;
+            finishPrewarm(multi, easy, msg->data.result);
+            easies.erase(std::find(easies.begin(), easies.end(), easy));
+        }
+        if(easies.empty()) break;
+#if CURL_AT_LEAST_VERSION(7, 66, 0)
+        mres = curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+#else
+        mres = curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+#endif
+        if(mres != CURLM_OK) break;
+    }
+    for(auto &easy : easies) finishPrewarm(multi, easy, CURLE_ABORTED_BY_CALLBACK);
+    if(share) curl_multi_cleanup(multi);
+    if(mres != CURLM_OK) {
+        vm.fail(loc, "failed to run prewarm requests: ", curl_multi_strerror(mres));
+        return nullptr;
+    }
+
+    VarVec *res = vm.makeVar<VarVec>(loc, hosts.size(), false);
+    for(auto &host : hosts) {
+        VarMap *item = vm.makeVar<VarMap>(loc, 4, false);
+        item->insert(vm, "url", vm.makeVar<VarStr>(loc, host.url), true);
+        item->insert(vm, "result", vm.makeVar<VarInt>(loc, host.result), true);
+        item->insert(vm, "connections", vm.makeVar<VarInt>(loc, host.connections), true);
+        item->insert(vm, "connectTime", vm.makeVar<VarInt>(loc, host.connectTime), true);
+        res->push(vm, item, true);
+    }
+    return res;
+}
+
+FERAL_FUNC(feralCurlSetProgressInterval, 2, false, "")
+{
+    EXPECT(VarInt, args[1], "interval in milliseconds");
+    EXPECT(VarInt, args[2], "interval in bytes");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    curl->setProgInterval(as<VarInt>(args[1])->getVal(), as<VarInt>(args[2])->getVal());
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlSetBuffered, 1, false, "")
+{
+    EXPECT(VarBool, args[1], "enabled");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    curl->setWriteBuffered(vm, as<VarBool>(args[1])->getVal());
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlSetWriteCoalesce, 1, false, "")
+{
+    EXPECT(VarInt, args[1], "minimum bytes per call");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    curl->setWriteCoalesce(std::max<int64_t>(0, as<VarInt>(args[1])->getVal()));
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlSetJson, 1, false, "")
+{
+    EXPECT(VarBool, args[1], "enabled");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    curl->setWriteJson(vm, as<VarBool>(args[1])->getVal());
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlTakeJson, 0, false,
+           "  var.fn() -> Map | Vec | Str | Int | Flt | Bool | Nil\n"
+           "Returns the response body of the last transfer of the Curl `var` in JSON mode (see "
+           "`setJsonResponse()`), which was decoded while it was received - objects are Maps, and "
+           "arrays are Vecs. Returns nil for a 204 (No Content) or 304 (Not Modified) response, "
+           "and fails for any other empty body, or if it is not valid JSON.\n"
+           "The decoded data is moved out of `var`, so it can only be taken once.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    return takeJsonResponse(vm, loc, curl);
+}
+
+FERAL_FUNC(feralCurlTakeBuffer, 0, false,
+           "  var.fn() -> Str\n"
+           "Returns the response body collected by the last `perform()` of the Curl `var`, when "
+           "it is in buffered mode (see `setBuffered()`).\n"
+           "The body is moved out of `var` (not copied), so a second call returns an empty string.")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    VarStr *res = vm.makeVar<VarStr>(loc, "");
+    res->getVal().swap(curl->getWriteBuf());
+    return res;
+}
+
+FERAL_FUNC(feralCurlGetHeaders, 0, false,
+           "  var.fn() -> Map\n"
+           "Returns the headers of the last response received by the Curl `var`, as a map of "
+           "lowercase header names to their values (the values of repeated headers are joined "
+           "with `, `).")
+{
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    StringMap<String> &headers = curl->getRespHeaders();
+    VarMap *res                = vm.makeVar<VarMap>(loc, headers.size(), false);
+    for(auto &h : headers) res->insert(vm, h.first, vm.makeVar<VarStr>(loc, h.second), true);
+    return res;
+}
+
+FERAL_FUNC(feralCurlGetHeader, 1, false,
+           "  var.fn(name) -> Str | Nil\n"
+           "Returns the value of the header `name` (case insensitive) from the last response "
+           "received by the Curl `var`, or nil if the response did not have it.")
+{
+    EXPECT(VarStr, args[1], "header name");
+    VarCurl *curl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, curl)) return nullptr;
+    String name = as<VarStr>(args[1])->getVal();
+    for(auto &c : name) c = std::tolower((unsigned char)c);
+    StringMap<String> &headers = curl->getRespHeaders();
+    auto it                    = headers.find(name);
+    if(it == headers.end()) return vm.getNil();
+    return vm.makeVar<VarStr>(loc, it->second);
+}
+
+FERAL_FUNC(feralCurlEasyGetInfoNative, 2, false,
+           "  var.fn(option, value) -> Int\n"
+           "Gets the info for the Curl `option` in the curl object `var` into `value`, and returns "
+           "the integer result.\n"
+           "Here, type of `value` depends on the `option` being used - Str for strings, Int for "
+           "longs, sockets, and sizes/times (`*_T`, microseconds), Flt for doubles, and Vec for "
+           "lists (a Vec of Vecs of Str for INFO_CERTINFO).")
+{
+    EXPECT(VarInt, args[1], "option type (CURL_INFO_*)");
+    VarCurl *varCurl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, varCurl)) return nullptr;
+    CURL *curl = varCurl->getVal();
+    int opt    = as<VarInt>(args[1])->getVal();
+    Var *arg   = args[2];
+
+    int res = CURLE_OK;
+    // the type of the info is encoded in the option itself
+    switch(opt & CURLINFO_TYPEMASK) {
+    case CURLINFO_STRING: {
+        EXPECT(VarStr, arg, "option value");
+        char *val = nullptr;
+        res       = curl_easy_getinfo(curl, (CURLINFO)opt, &val);
+        as<VarStr>(arg)->setVal(val ? val : "");
+        break;
+    }
+    case CURLINFO_LONG: {
+        EXPECT(VarInt, arg, "option value");
+        long val = 0;
+        res      = curl_easy_getinfo(curl, (CURLINFO)opt, &val);
+        as<VarInt>(arg)->setVal(val);
+        break;
+    }
+    case CURLINFO_DOUBLE: {
+        EXPECT(VarFlt, arg, "option value");
+        double val = 0.0;
+        res        = curl_easy_getinfo(curl, (CURLINFO)opt, &val);
+        as<VarFlt>(arg)->setVal(val);
+        break;
+    }
+    case CURLINFO_OFF_T: {
+        EXPECT(VarInt, arg, "option value");
+        curl_off_t val = 0;
+        res            = curl_easy_getinfo(curl, (CURLINFO)opt, &val);
+        as<VarInt>(arg)->setVal(val);
+        break;
+    }
+    case CURLINFO_SOCKET: {
+        EXPECT(VarInt, arg, "option value");
+        curl_socket_t sockfd = CURL_SOCKET_BAD;
+        res                  = curl_easy_getinfo(curl, (CURLINFO)opt, &sockfd);
+        as<VarInt>(arg)->setVal(sockfd == CURL_SOCKET_BAD ? -1 : (int64_t)sockfd);
+        break;
+    }
+    case CURLINFO_SLIST: { // same as CURLINFO_PTR
+        EXPECT(VarVec, arg, "option value");
+        VarVec *vec = as<VarVec>(arg);
+        if(opt == CURLINFO_CERTINFO) {
+            curl_certinfo *certs = nullptr;
+            res                  = curl_easy_getinfo(curl, CURLINFO_CERTINFO, &certs);
+            if(res != CURLE_OK) break;
+            for(auto &e : vec->getVal()) vm.decVarRef(e);
+            vec->getVal().clear();
+            for(int i = 0; certs && i < certs->num_of_certs; ++i) {
+                VarVec *cert = vm.makeVar<VarVec>(loc, 0, false);
+                for(curl_slist *it = certs->certinfo[i]; it; it = it->next) {
+                    cert->push(vm, vm.makeVar<VarStr>(loc, it->data), true);
+                }
+                vec->push(vm, cert, true);
+            }
+            break;
+        }
+        if(opt != CURLINFO_SSL_ENGINES && opt != CURLINFO_COOKIELIST) {
+            // raw pointers (INFO_PRIVATE, INFO_TLS_SSL_PTR, ...) have no Feral representation
+            vm.fail(loc, "operation is not supported");
+            return nullptr;
+        }
+        curl_slist *list = nullptr;
+        res              = curl_easy_getinfo(curl, (CURLINFO)opt, &list);
+        if(res != CURLE_OK) break;
+        for(auto &e : vec->getVal()) vm.decVarRef(e);
+        vec->getVal().clear();
+        for(curl_slist *it = list; it; it = it->next) {
+            vec->push(vm, vm.makeVar<VarStr>(loc, it->data), true);
+        }
+        curl_slist_free_all(list);
+        break;
+    }
+    default: {
+        vm.fail(loc, "operation is not yet implemented");
+        return nullptr;
+    }
+    }
+    return vm.makeVar<VarInt>(loc, res);
+}
+
+// The counters returned by getMetrics(), times are in microseconds and sizes are in bytes.
+static const std::pair<const char *, CURLINFO> curlMetrics[] = {
+#if CURL_AT_LEAST_VERSION(8, 6, 0)
+    {"queueTime", CURLINFO_QUEUE_TIME_T},
+#endif
+    {"nameLookupTime", CURLINFO_NAMELOOKUP_TIME_T},
+    {"connectTime", CURLINFO_CONNECT_TIME_T},
+    {"appConnectTime", CURLINFO_APPCONNECT_TIME_T},
+    {"preTransferTime", CURLINFO_PRETRANSFER_TIME_T},
+#if CURL_AT_LEAST_VERSION(8, 10, 0)
+    {"postTransferTime", CURLINFO_POSTTRANSFER_TIME_T},
+#endif
+    {"startTransferTime", CURLINFO_STARTTRANSFER_TIME_T},
+    {"totalTime", CURLINFO_TOTAL_TIME_T},
+    {"redirectTime", CURLINFO_REDIRECT_TIME_T},
+    {"redirectCount", CURLINFO_REDIRECT_COUNT},
+    {"responseCode", CURLINFO_RESPONSE_CODE},
+    {"httpVersion", CURLINFO_HTTP_VERSION},
+    {"numConnects", CURLINFO_NUM_CONNECTS},
+    {"headerSize", CURLINFO_HEADER_SIZE},
+    {"requestSize", CURLINFO_REQUEST_SIZE},
+    {"sizeUpload", CURLINFO_SIZE_UPLOAD_T},
+    {"sizeDownload", CURLINFO_SIZE_DOWNLOAD_T},
+    {"speedUpload", CURLINFO_SPEED_UPLOAD_T},
+    {"speedDownload", CURLINFO_SPEED_DOWNLOAD_T},
+    {"contentLengthUpload", CURLINFO_CONTENT_LENGTH_UPLOAD_T},
+    {"contentLengthDownload", CURLINFO_CONTENT_LENGTH_DOWNLOAD_T},
+};
+
+FERAL_FUNC(feralCurlEasyGetMetrics, 0, false,
+           "  var.fn() -> Map\n"
+           "Returns the timing (in microseconds) and size (in bytes) counters of the last transfer "
+           "of the Curl `var` in a single map - queueTime, nameLookupTime, connectTime, "
+           "appConnectTime, preTransferTime, postTransferTime, startTransferTime, totalTime, "
+           "redirectTime, redirectCount, responseCode, httpVersion, numConnects, headerSize, "
+           "requestSize, sizeUpload, sizeDownload, speedUpload, speedDownload, "
+           "contentLengthUpload, and contentLengthDownload (-1 if unknown).\n"
+           "The time counters are cumulative from the start of the transfer, as with the "
+           "INFO_*_TIME_T infos.")
+{
+    VarCurl *varCurl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, varCurl)) return nullptr;
+    CURL *curl = varCurl->getVal();
+    VarMap *res =
+        vm.makeVar<VarMap>(loc, sizeof(curlMetrics) / sizeof(curlMetrics[0]), false);
+    for(auto &m : curlMetrics) {
+        int64_t val = 0;
+        if((m.second & CURLINFO_TYPEMASK) == CURLINFO_OFF_T) {
+            curl_off_t v = 0;
+            curl_easy_getinfo(curl, m.second, &v);
+            val = v;
+        } else {
+            long v = 0;
+            curl_easy_getinfo(curl, m.second, &v);
+            val = v;
+        }
+        res->insert(vm, m.first, vm.makeVar<VarInt>(loc, val), true);
+    }
+    return res;
+}
+
+// How the value of an easy option is converted, see curlOptKind()
+enum class CurlOptKind
+{
+    LONG,
+    OFF_T,
+    STRING,
+    SLIST,
+    BLOB,
+    SPECIAL, // handled manually by setSpecialEasyOpt()
+    UNSUPPORTED,
+};
+
+// Returns the kind of the easy option `opt`, as per its CURLOPTTYPE range - with the exception of
+// the object options which are not strings, since they share the range with strings.
+constexpr CurlOptKind curlOptKind(int opt)
+{
+    switch(opt) {
+    case CURLOPT_POSTFIELDS:
+    case CURLOPT_MIMEPOST:
+    case CURLOPT_XFERINFOFUNCTION:
+    case CURLOPT_WRITEFUNCTION:
+    case CURLOPT_WRITEDATA:
+    case CURLOPT_READFUNCTION:
+    case CURLOPT_READDATA:
+    case CURLOPT_HEADERFUNCTION:
+    case CURLOPT_STREAM_DEPENDS:
+    case CURLOPT_STREAM_DEPENDS_E:
+    case CURLOPT_SHARE:
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    case CURLOPT_CURLU:
+#endif
+        return CurlOptKind::SPECIAL;
+    // CURLOPTTYPE_SLISTPOINT
+    case CURLOPT_HTTPHEADER:
+    case CURLOPT_PROXYHEADER:
+    case CURLOPT_QUOTE:
+    case CURLOPT_POSTQUOTE:
+    case CURLOPT_PREQUOTE:
+    case CURLOPT_TELNETOPTIONS:
+    case CURLOPT_HTTP200ALIASES:
+    case CURLOPT_MAIL_RCPT:
+    case CURLOPT_RESOLVE:
+    case CURLOPT_CONNECT_TO: return CurlOptKind::SLIST;
+    // CURLOPTTYPE_CBPOINT, and object pointers which have no Feral representation
+    case CURLOPT_ERRORBUFFER:
+    case CURLOPT_STDERR:
+    case CURLOPT_PRIVATE:
+    case CURLOPTTYPE_OBJECTPOINT + 24:  // CURLOPT_HTTPPOST (deprecated)
+    case CURLOPTTYPE_CBPOINT + 131:     // CURLOPT_IOCTLDATA (deprecated)
+    case CURLOPT_HEADERDATA:
+    case CURLOPT_XFERINFODATA:
+    case CURLOPT_DEBUGDATA:
+    case CURLOPT_SSL_CTX_DATA:
+    case CURLOPT_SOCKOPTDATA:
+    case CURLOPT_OPENSOCKETDATA:
+    case CURLOPT_CLOSESOCKETDATA:
+    case CURLOPT_SEEKDATA:
+    case CURLOPT_SSH_KEYDATA:
+    case CURLOPT_INTERLEAVEDATA:
+    case CURLOPT_CHUNK_DATA:
+    case CURLOPT_FNMATCH_DATA:
+#if CURL_AT_LEAST_VERSION(7, 59, 0)
+    case CURLOPT_RESOLVER_START_DATA:
+#endif
+#if CURL_AT_LEAST_VERSION(7, 64, 0)
+    case CURLOPT_TRAILERDATA:
+#endif
+#if CURL_AT_LEAST_VERSION(7, 74, 0)
+    case CURLOPT_HSTSREADDATA:
+    case CURLOPT_HSTSWRITEDATA:
+#endif
+#if CURL_AT_LEAST_VERSION(7, 80, 0)
+    case CURLOPT_PREREQDATA:
+#endif
+#if CURL_AT_LEAST_VERSION(7, 84, 0)
+    case CURLOPT_SSH_HOSTKEYDATA:
+#endif
+        return CurlOptKind::UNSUPPORTED;
+    default: break;
+    }
+    if(opt < CURLOPTTYPE_LONG) return CurlOptKind::UNSUPPORTED;
+    if(opt < CURLOPTTYPE_OBJECTPOINT) return CurlOptKind::LONG;
+    if(opt < CURLOPTTYPE_FUNCTIONPOINT) return CurlOptKind::STRING;
+    if(opt < CURLOPTTYPE_OFF_T) return CurlOptKind::UNSUPPORTED; // the unhandled callbacks
+#if CURL_AT_LEAST_VERSION(7, 71, 0)
+    if(opt < CURLOPTTYPE_BLOB) return CurlOptKind::OFF_T;
+    if(opt < CURLOPTTYPE_BLOB + 10000) return CurlOptKind::BLOB;
+    return CurlOptKind::UNSUPPORTED;
+#else
+    if(opt < CURLOPTTYPE_OFF_T + 10000) return CurlOptKind::OFF_T;
+    return CurlOptKind::UNSUPPORTED;
+#endif
+}
+
+static_assert(curlOptKind(CURLOPT_TIMEOUT_MS) == CurlOptKind::LONG);
+static_assert(curlOptKind(CURLOPT_URL) == CurlOptKind::STRING);
+static_assert(curlOptKind(CURLOPT_MAXFILESIZE_LARGE) == CurlOptKind::OFF_T);
+static_assert(curlOptKind(CURLOPT_HTTPHEADER) == CurlOptKind::SLIST);
+static_assert(curlOptKind(CURLOPT_DEBUGFUNCTION) == CurlOptKind::UNSUPPORTED);
+// the deprecated options are numbered by hand, as their names warn
+static_assert(curlOptKind(CURLOPTTYPE_OBJECTPOINT + 24) == CurlOptKind::UNSUPPORTED);
+static_assert(curlOptKind(CURLOPTTYPE_CBPOINT + 131) == CurlOptKind::UNSUPPORTED);
+
+// Sets the CurlOptKind::SPECIAL option `opt`, which needs more than a conversion of the value
+Var *setSpecialEasyOpt(VirtualMachine &vm, ModuleLoc loc, VarCurl *varCurl, int opt, Var *arg,
+                       Span<Var *> cbArgs)
+{
+    CURL *curl = varCurl->getVal();
+
+    int res = CURLE_OK;
+    // manually handle each of the options and work accordingly
+    switch(opt) {
+    case CURLOPT_POSTFIELDS: {
+        // We don't want POSTFIELDS as it doesn't copy the string data to curl,
+        // which is annoying to deal with.
+        EXPECT(VarStr, arg, "option value");
+        res = curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, as<VarStr>(arg)->getVal().c_str());
+        break;
+    }
+    case CURLOPT_MIMEPOST: {
+        // The previous mime (if any) is freed.
+        if(arg->is<VarNil>()) {
+            res = varCurl->setMime(nullptr);
+            break;
+        }
+        EXPECT(VarMap, arg, "name-data pairs");
+        curl_mime *mime = varCurl->createMime(vm, loc, as<VarMap>(arg));
+        if(!mime) {
+            vm.fail(loc, "failed to create mime from the given map (possibly empty map)");
+            return nullptr;
+        }
+        res = varCurl->setMime(mime);
+        break;
+    }
+    case CURLOPT_XFERINFOFUNCTION: {
+        if(arg->is<VarNil>()) {
+            varCurl->setProgressCB(vm, nullptr, {});
+            break;
+        }
+        EXPECT(VarFn, arg, "xfer info function");
+        VarFn *f = as<VarFn>(arg);
+        if(f->getParamCount() < 4) {
+            vm.fail(loc, "expected function to have at least 4",
+                    " parameters for this option, found: ", f->getParamCount());
+            return nullptr;
+        }
+        varCurl->setProgressCB(vm, f, cbArgs);
+        break;
+    }
+    case CURLOPT_WRITEFUNCTION: {
+        if(arg->is<VarNil>()) {
+            varCurl->setWriteCB(vm, nullptr, {});
+            break;
+        }
+        EXPECT(VarFn, arg, "write function");
+        VarFn *f = as<VarFn>(arg);
+        if(f->getParamCount() < 1) {
+            vm.fail(loc, "expected function to have at least 1",
+                    " parameter for this option, found: ", f->getParamCount());
+            return nullptr;
+        }
+        varCurl->setWriteFile(vm, nullptr);
+        varCurl->setWriteCB(vm, f, cbArgs);
+        break;
+    }
+    case CURLOPT_WRITEDATA: {
+        // The data is written natively, without going through the VM (or the write callback).
+        if(arg->is<VarNil>()) {
+            varCurl->setWriteFile(vm, nullptr);
+            break;
+        }
+        if(arg->is<VarInt>()) {
+            varCurl->setWriteFd(vm, as<VarInt>(arg)->getVal());
+            break;
+        }
+        EXPECT(VarFile, arg, "file or file descriptor to write to");
+        if(!as<VarFile>(arg)->getFile()) {
+            vm.fail(loc, "the given file is not open");
+            return nullptr;
+        }
+        varCurl->setWriteFile(vm, as<VarFile>(arg));
+        break;
+    }
+    case CURLOPT_READFUNCTION: {
+        if(arg->is<VarNil>()) {
+            varCurl->setReadCB(vm, nullptr, {});
+            break;
+        }
+        EXPECT(VarFn, arg, "read function");
+        VarFn *f = as<VarFn>(arg);
+        if(f->getParamCount() < 1) {
+            vm.fail(loc, "expected function to have at least 1",
+                    " parameter for this option, found: ", f->getParamCount());
+            return nullptr;
+        }
+        varCurl->setReadCB(vm, f, cbArgs);
+        break;
+    }
+    case CURLOPT_HEADERFUNCTION: {
+        // The headers are always collected natively (see getHeaders()), this is only needed to
+        // stream them.
+        if(arg->is<VarNil>()) {
+            varCurl->setHeaderCB(vm, nullptr, {});
+            break;
+        }
+        EXPECT(VarFn, arg, "header function");
+        VarFn *f = as<VarFn>(arg);
+        if(f->getParamCount() < 1) {
+            vm.fail(loc, "expected function to have at least 1",
+                    " parameter for this option, found: ", f->getParamCount());
+            return nullptr;
+        }
+        varCurl->setHeaderCB(vm, f, cbArgs);
+        break;
+    }
+    case CURLOPT_READDATA: {
+        // The data is read natively, without going through the VM (or the read callback).
+        // A string is taken as the path of a file, which is memory mapped.
+        if(arg->is<VarNil>()) {
+            varCurl->setReadFile(vm, nullptr);
+            break;
+        }
+        if(arg->is<VarInt>()) {
+            varCurl->setReadFd(vm, as<VarInt>(arg)->getVal());
+            break;
+        }
+        if(arg->is<VarStr>()) {
+            if(!varCurl->setReadMappedFile(vm, as<VarStr>(arg)->getVal().c_str())) {
+                vm.fail(loc, "failed to memory map file: ", as<VarStr>(arg)->getVal());
+                return nullptr;
+            }
+            break;
+        }
+        EXPECT(VarFile, arg, "file, file descriptor, or file path to read from");
+        if(!as<VarFile>(arg)->getFile()) {
+            vm.fail(loc, "the given file is not open");
+            return nullptr;
+        }
+        varCurl->setReadFile(vm, as<VarFile>(arg));
+        break;
+    }
+    case CURLOPT_STREAM_DEPENDS: // fallthrough
+    case CURLOPT_STREAM_DEPENDS_E: {
+        if(arg->is<VarNil>()) {
+            res = varCurl->setStreamDep(vm, (CURLoption)opt, nullptr);
+            break;
+        }
+        EXPECT(VarCurl, arg, "curl easy handle");
+        if(arg == varCurl) {
+            vm.fail(loc, "a curl handle cannot depend on itself");
+            return nullptr;
+        }
+        res = varCurl->setStreamDep(vm, (CURLoption)opt, as<VarCurl>(arg));
+        break;
+    }
+    case CURLOPT_SHARE: {
+        if(arg->is<VarNil>()) {
+            res = varCurl->setShare(vm, nullptr);
+            break;
+        }
+        EXPECT(VarCurlShare, arg, "curl share handle");
+        res = varCurl->setShare(vm, as<VarCurlShare>(arg));
+        break;
+    }
+#if CURL_AT_LEAST_VERSION(7, 63, 0)
+    case CURLOPT_CURLU: {
+        if(arg->is<VarNil>()) {
+            res = varCurl->setCurlUrl(vm, nullptr);
+            break;
+        }
+        EXPECT(VarCurlUrl, arg, "curl url");
+        res = varCurl->setCurlUrl(vm, as<VarCurlUrl>(arg));
+        break;
+    }
+#endif
+    default: {
+        vm.fail(loc, "operation is not yet implemented");
+        return nullptr;
+    }
+    }
+    return vm.makeVar<VarInt>(loc, res);
+}
+
+// Sets the easy option `opt` of `varCurl` to `arg`, with `cbArgs` being the extra arguments for
+// the callback options.
+// Returns the CURLcode as a VarInt, or nullptr if it failed.
+Var *setEasyOpt(VirtualMachine &vm, ModuleLoc loc, VarCurl *varCurl, int opt, Var *arg,
+                Span<Var *> cbArgs)
+{
+    CURL *curl = varCurl->getVal();
+
+    int res = CURLE_OK;
+    switch(curlOptKind(opt)) {
+    case CurlOptKind::SPECIAL: {
+        Var *specialRes = setSpecialEasyOpt(vm, loc, varCurl, opt, arg, cbArgs);
+        if(specialRes && as<VarInt>(specialRes)->getVal() == CURLE_OK) {
+            varCurl->trackRequestOpt(opt, arg);
+        }
+        return specialRes;
+    }
+    case CurlOptKind::LONG: {
+        if(!arg->is<VarInt>() && !arg->is<VarBool>()) {
+            vm.fail(loc, "expected an int or bool option value");
+            return nullptr;
+        }
+        long val = arg->is<VarInt>() ? as<VarInt>(arg)->getVal() : as<VarBool>(arg)->getVal();
+        res      = curl_easy_setopt(curl, (CURLoption)opt, val);
+        break;
+    }
+    case CurlOptKind::OFF_T: {
+        EXPECT(VarInt, arg, "option value");
+        res = curl_easy_setopt(curl, (CURLoption)opt, (curl_off_t)as<VarInt>(arg)->getVal());
+        break;
+    }
+    case CurlOptKind::STRING: {
+        // libcurl copies the strings, nil resets the option to its default
+        if(arg->is<VarNil>()) {
+            res = curl_easy_setopt(curl, (CURLoption)opt, (char *)nullptr);
+            break;
+        }
+        EXPECT(VarStr, arg, "option value");
+        res = curl_easy_setopt(curl, (CURLoption)opt, as<VarStr>(arg)->getVal().c_str());
+        break;
+    }
+    case CurlOptKind::SLIST: {
+        // The previous list (if any) is freed, and a prebuilt VarCurlSList is used as is.
+        if(arg->is<VarNil>()) {
+            res = varCurl->setSList(vm, (CURLoption)opt, nullptr, nullptr);
+            break;
+        }
+        if(arg->is<VarCurlSList>()) {
+            res = varCurl->setSList(vm, (CURLoption)opt, nullptr, as<VarCurlSList>(arg));
+            break;
+        }
+        curl_slist *lst = createSList(vm, loc, arg);
+        if(!lst) return nullptr;
+        res = varCurl->setSList(vm, (CURLoption)opt, lst, nullptr);
+        break;
+    }
+#if CURL_AT_LEAST_VERSION(7, 71, 0)
+    case CurlOptKind::BLOB: {
+        if(arg->is<VarNil>()) {
+            res = curl_easy_setopt(curl, (CURLoption)opt, (curl_blob *)nullptr);
+            break;
+        }
+        EXPECT(VarStr, arg, "option value (blob data)");
+        String &data   = as<VarStr>(arg)->getVal();
+        curl_blob blob = {(void *)data.data(), data.size(), CURL_BLOB_COPY};
+        res            = curl_easy_setopt(curl, (CURLoption)opt, &blob);
+        break;
+    }
+#endif
+    default: {
+        vm.fail(loc, "operation is not yet implemented");
+        return nullptr;
+    }
+    }
+    if(res == CURLE_OK) varCurl->trackRequestOpt(opt, arg);
+    return vm.makeVar<VarInt>(loc, res);
+}
+
+FERAL_FUNC(feralCurlEasySetOptNative, 2, true,
+           "  var.fn(option, suboption/value...) -> Int\n"
+           "Sets the `option` in Curl `var` as with one/more `suboption/value` and returns the "
+           "integer result.\n"
+           "Here, type and count of `suboption/value` are dependent on the `option` being used.")
+{
+    EXPECT(VarInt, args[1], "option type (CURL_OPT_*)");
+    VarCurl *varCurl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, varCurl)) return nullptr;
+    Span<Var *> cbArgs{args.begin() + 3, args.end()};
+    return setEasyOpt(vm, loc, varCurl, as<VarInt>(args[1])->getVal(), args[2], cbArgs);
+}
+
+FERAL_FUNC(feralCurlEasySetOpts, 1, false,
+           "  var.fn(options) -> Int\n"
+           "Sets all the `options` in Curl `var` in one call, where `options` is a map of option "
+           "names (as in OPT_*, with or without the `OPT_` prefix, case insensitive) to their "
+           "values.\n"
+           "Returns the CURLcode of the first option which could not be set (leaving the rest "
+           "unset), or E_OK. The options are set in no particular order, and the callback "
+           "options get no extra arguments.")
+{
+    EXPECT(VarMap, args[1], "map of option names to values");
+    VarCurl *varCurl = as<VarCurl>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, varCurl)) return nullptr;
+#if CURL_AT_LEAST_VERSION(7, 73, 0)
+    for(auto &o : as<VarMap>(args[1])->getVal()) {
+        String name(o.first);
+        if(name.size() > 4 && std::equal(name.begin(), name.begin() + 4, "OPT_",
+                                         [](char a, char b) { return std::toupper(a) == b; }))
+        {
+            name.erase(0, 4);
+        }
+        const curl_easyoption *info = curl_easy_option_by_name(name.c_str());
+        if(!info) {
+            vm.fail(loc, "unknown curl option: ", o.first);
+            return nullptr;
+        }
+        Var *res = setEasyOpt(vm, loc, varCurl, info->id, o.second, {});
+        if(!res) return nullptr;
+        if(as<VarInt>(res)->getVal() != CURLE_OK) return res;
+        vm.decVarRef(res);
+    }
+    return vm.makeVar<VarInt>(loc, CURLE_OK);
+#else
+    vm.fail(loc, "setting options by name requires libcurl 7.73.0 or newer");
+    return nullptr;
+#endif
+}
 
-curl_mime *VarCurl::createMime(VirtualMachine &vm, ModuleLoc loc, Var *data)
+FERAL_FUNC(feralCurlShareInit, 0, true,
+           "  fn(lockData...) -> CurlShare\n"
+           "Creates and returns a CurlShare instance which shares the data types `lockData` "
+           "(LOCK_DATA_*) among all the Curl handles it is attached to (via OPT_SHARE).\n"
+           "If no `lockData` is given, the DNS cache, TLS session cache, connection pool, and PSL "
+           "are shared.\n"
+           "Note that libcurl does not support sharing the connection pool between handles that "
+           "are performing concurrently on different threads, so `performAsync()` fails for the "
+           "handles attached to a CurlShare which shares it.")
 {
-    if(data->is<VarMap>() && as<VarMap>(data)->getVal().empty()) return nullptr;
-
-    mimelist.push_front(curl_mime_init(val));
-    curl_mime *mime = mimelist.front();
-    if(data->is<VarStr>()) {
-        curl_mimepart *part = curl_mime_addpart(mime);
-        curl_mime_filedata(part, as<VarStr>(data)->getVal().c_str());
-        curl_mime_filename(part, as<VarStr>(data)->getVal().c_str());
-    } else {
-        VarMap *map = as<VarMap>(data);
-        for(auto &item : map->getVal()) {
-            Var *v = nullptr;
-            Array<Var *, 1> tmp{item.second};
-            if(!vm.callVarAndExpect<VarStr>(loc, "str", v, tmp, {})) {
-                curl_mime_free(mime);
-                mimelist.pop_front();
-                return nullptr;
-            }
-            const String &str   = as<VarStr>(v)->getVal();
-            curl_mimepart *part = curl_mime_addpart(mime);
-            curl_mime_name(part, item.first.c_str());
-            curl_mime_data(part, str.c_str(), str.size());
-            vm.decVarRef(v);
+    for(size_t i = 1; i < args.size(); ++i) {
+        EXPECT(VarInt, args[i], "lock data type (LOCK_DATA_*)");
+    }
+    CURLSH *share = curl_share_init();
+    if(!share) {
+        vm.fail(loc, "failed to run curl_share_init()");
+        return nullptr;
+    }
+    VarCurlShare *res = vm.makeVar<VarCurlShare>(loc, share);
+    if(args.size() > 1) {
+        for(size_t i = 1; i < args.size(); ++i) {
+            res->setShared((curl_lock_data)as<VarInt>(args[i])->getVal(), true);
         }
+        return res;
     }
-    return mime;
+    res->setShared(CURL_LOCK_DATA_DNS, true);
+    res->setShared(CURL_LOCK_DATA_SSL_SESSION, true);
+#if CURL_AT_LEAST_VERSION(7, 57, 0)
+    res->setShared(CURL_LOCK_DATA_CONNECT, true);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 61, 0)
+    res->setShared(CURL_LOCK_DATA_PSL, true);
+#endif
+    return res;
 }
-void VarCurl::clearMimeData()
+
+FERAL_FUNC(feralCurlShareStrErrFromInt, 1, false,
+           "  fn(errCode) -> Str\n"
+           "Returns the string representation of the share error code `errCode`.")
 {
-    while(!mimelist.empty()) {
-        curl_mime_free(mimelist.front());
-        mimelist.pop_front();
-    }
+    EXPECT(VarInt, args[1], "error code");
+    CURLSHcode code = (CURLSHcode)as<VarInt>(args[1])->getVal();
+    return vm.makeVar<VarStr>(loc, curl_share_strerror(code));
 }
 
-curl_slist *VarCurl::createSList(VirtualMachine &vm, ModuleLoc loc, Var *data)
+FERAL_FUNC(feralCurlShareSetOptNative, 2, false,
+           "  var.fn(option, value) -> Int\n"
+           "Sets the `option` (SHOPT_SHARE/SHOPT_UNSHARE) in CurlShare `var` to `value` "
+           "(LOCK_DATA_*) and returns the CURLSHcode.\n"
+           "This fails with SHE_IN_USE while any Curl handle is attached to `var`.")
 {
-    if(data->is<VarMap>() && as<VarMap>(data)->getVal().empty()) return nullptr;
+    EXPECT(VarInt, args[1], "option type (CURL_SHOPT_*)");
+    EXPECT(VarInt, args[2], "lock data type (LOCK_DATA_*)");
+    VarCurlShare *share = as<VarCurlShare>(args[0]);
+    int opt             = as<VarInt>(args[1])->getVal();
+    if(opt != CURLSHOPT_SHARE && opt != CURLSHOPT_UNSHARE) {
+        vm.fail(loc, "operation is not yet implemented");
+        return nullptr;
+    }
+    CURLSHcode res = share->setShared((curl_lock_data)as<VarInt>(args[2])->getVal(),
+                                      opt == CURLSHOPT_SHARE);
+    return vm.makeVar<VarInt>(loc, res);
+}
 
-    sllist.push_front(nullptr);
-    curl_slist *&lst = sllist.front();
-    if(data->is<VarStr>()) {
-        lst = curl_slist_append(lst, as<VarStr>(data)->getVal().c_str());
-    } else {
-        String tmpStr;
-        VarMap *map = as<VarMap>(data);
-        for(auto &item : map->getVal()) {
-            Var *v = nullptr;
-            Array<Var *, 1> tmp{item.second};
-            if(!vm.callVarAndExpect<VarStr>(loc, "str", v, tmp, {})) {
-                curl_slist_free_all(lst);
-                sllist.pop_front();
-                return nullptr;
-            }
-            const String &str = as<VarStr>(v)->getVal();
-            tmpStr.clear();
-            tmpStr += item.first;
-            tmpStr += ": ";
-            tmpStr += str.c_str();
-            lst = curl_slist_append(lst, tmpStr.c_str());
-            vm.decVarRef(v);
+FERAL_FUNC(feralCurlUrlInit, 2, false,
+           "  fn(url, flags) -> CurlUrl\n"
+           "Creates and returns a CurlUrl by parsing `url` (nil for an empty one) as per the "
+           "`flags` (U_*, ORed together).\n"
+           "Its parts are read and changed individually, without reparsing the rest of it, and it "
+           "is used by Curl handles as is via OPT_CURLU (which takes precedence over OPT_URL).")
+{
+    if(!args[1]->is<VarNil>()) EXPECT(VarStr, args[1], "url to parse, or nil");
+    EXPECT(VarInt, args[2], "url flags (U_*)");
+    CURLU *url = curl_url();
+    if(!url) {
+        vm.fail(loc, "failed to run curl_url()");
+        return nullptr;
+    }
+    if(args[1]->is<VarStr>()) {
+        const String &str = as<VarStr>(args[1])->getVal();
+        CURLUcode code =
+            curl_url_set(url, CURLUPART_URL, str.c_str(), as<VarInt>(args[2])->getVal());
+        if(code != CURLUE_OK) {
+            curl_url_cleanup(url);
+            vm.fail(loc, "failed to parse url '", str, "': ", curlUrlStrerror(code));
+            return nullptr;
         }
     }
-    return lst;
+    return vm.makeVar<VarCurlUrl>(loc, url);
 }
-void VarCurl::clearSList()
+
+FERAL_FUNC(feralCurlUrlStrErrFromInt, 1, false,
+           "  fn(errCode) -> Str\n"
+           "Returns the string representation of the url error code `errCode`.")
 {
-    while(!sllist.empty()) {
-        curl_slist_free_all(sllist.front());
-        sllist.pop_front();
-    }
+    EXPECT(VarInt, args[1], "error code");
+    return vm.makeVar<VarStr>(loc, curlUrlStrerror((CURLUcode)as<VarInt>(args[1])->getVal()));
 }
 
-CurlCallbackData::CurlCallbackData(ModuleLoc loc, VirtualMachine &vm, VarCurl *curl)
-    : loc(loc), vm(vm), curl(curl)
-{}
+FERAL_FUNC(feralCurlUrlGetPartNative, 2, false,
+           "  var.fn(part, flags) -> Str | Nil\n"
+           "Returns the `part` (UPART_*) of CurlUrl `var` as per the `flags` (U_*, such as "
+           "U_URLDECODE or U_DEFAULT_PORT), or nil if the URL does not have that part.")
+{
+    EXPECT(VarInt, args[1], "url part (UPART_*)");
+    EXPECT(VarInt, args[2], "url flags (U_*)");
+    CURLU *url     = as<VarCurlUrl>(args[0])->getVal();
+    char *part     = nullptr;
+    CURLUcode code = curl_url_get(url, (CURLUPart)as<VarInt>(args[1])->getVal(), &part,
+                                  as<VarInt>(args[2])->getVal());
+    if(isMissingUrlPart(code)) return vm.getNil();
+    if(code != CURLUE_OK) {
+        vm.fail(loc, "failed to get url part: ", curlUrlStrerror(code));
+        return nullptr;
+    }
+    VarStr *res = vm.makeVar<VarStr>(loc, part);
+    curl_free(part);
+    return res;
+}
 
-//////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////// Functions ////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////////////
+FERAL_FUNC(feralCurlUrlSetPartNative, 3, false,
+           "  var.fn(part, value, flags) -> Int\n"
+           "Sets the `part` (UPART_*) of CurlUrl `var` to `value` (nil to remove it) as per the "
+           "`flags` (U_*, such as U_URLENCODE), and returns the CURLUcode.\n"
+           "A relative URL set as UPART_URL is resolved against the current one.")
+{
+    EXPECT(VarInt, args[1], "url part (UPART_*)");
+    if(!args[2]->is<VarNil>()) EXPECT(VarStr, args[2], "part value, or nil");
+    EXPECT(VarInt, args[3], "url flags (U_*)");
+    CURLU *url        = as<VarCurlUrl>(args[0])->getVal();
+    const char *value = args[2]->is<VarStr>() ? as<VarStr>(args[2])->getVal().c_str() : nullptr;
+    CURLUcode res     = curl_url_set(url, (CURLUPart)as<VarInt>(args[1])->getVal(), value,
+                                     as<VarInt>(args[3])->getVal());
+    return vm.makeVar<VarInt>(loc, res);
+}
 
-FERAL_FUNC(feralCurlGlobalTrace, 1, false,
-           "  fn(trace) -> Int\n"
-           "Sets the global `trace` config for the curl library.")
+FERAL_FUNC(feralCurlUrlAppendQuery, 2, false,
+           "  var.fn(name, value) -> Int\n"
+           "Appends the query parameter `name`=`value` (`value` is converted using its `str()`) "
+           "to CurlUrl `var`, URL encoding both, and returns the CURLUcode.")
 {
-    EXPECT(VarStr, args[1], "trace config");
-    int res = curl_global_trace(as<VarStr>(args[1])->getVal().c_str());
+    EXPECT(VarStr, args[1], "query parameter name");
+    Var *value = nullptr;
+    Array<Var *, 1> tmp{args[2]};
+    if(!vm.callVarAndExpect<VarStr>(loc, "str", value, tmp, {})) return nullptr;
+    const String &name = as<VarStr>(args[1])->getVal();
+    const String &str  = as<VarStr>(value)->getVal();
+    // escaped here, since CURLU_URLENCODE would leave a '=' in the name as the separator
+    char *escName  = curl_easy_escape(nullptr, name.c_str(), name.size());
+    char *escValue = curl_easy_escape(nullptr, str.c_str(), str.size());
+    vm.decVarRef(value);
+    if(!escName || !escValue) {
+        curl_free(escName);
+        curl_free(escValue);
+        return vm.makeVar<VarInt>(loc, CURLUE_OUT_OF_MEMORY);
+    }
+    String param = escName;
+    param += '=';
+    param += escValue;
+    curl_free(escName);
+    curl_free(escValue);
+    CURLUcode res = curl_url_set(as<VarCurlUrl>(args[0])->getVal(), CURLUPART_QUERY,
+                                 param.c_str(), CURLU_APPENDQUERY);
     return vm.makeVar<VarInt>(loc, res);
 }
 
-FERAL_FUNC(
-    feralCurlEasyInit, 0, false,
-    "  fn() -> Curl\n"
-    "Creates and returns a Curl (Easy) instance which can be used to perform network operations.")
+FERAL_FUNC(feralCurlUrlStr, 0, false,
+           "  var.fn() -> Str\n"
+           "Returns the full URL of CurlUrl `var`, or an empty string if it is incomplete (such "
+           "as without a host).")
 {
-    CURL *curl = curl_easy_init();
-    if(!curl) {
-        vm.fail(loc, "failed to run curl_easy_init()");
-        return nullptr;
+    char *full = nullptr;
+    if(curl_url_get(as<VarCurlUrl>(args[0])->getVal(), CURLUPART_URL, &full, 0) != CURLUE_OK) {
+        return vm.makeVar<VarStr>(loc, "");
     }
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgressCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWriteCallback);
-    return vm.makeVar<VarCurl>(loc, curl);
+    VarStr *res = vm.makeVar<VarStr>(loc, full);
+    curl_free(full);
+    return res;
 }
 
-FERAL_FUNC(feralCurlEasyPerform, 0, false,
-           "  var.fn() -> Int\n"
-           "Performs the required operations on the Curl object `var` and returns the status code "
-           "of the finished operation.")
+FERAL_FUNC(feralCurlUrlClone, 0, false,
+           "  var.fn() -> CurlUrl\n"
+           "Returns a copy of CurlUrl `var`, which can be changed independently of it.")
 {
-    CURL *curl = as<VarCurl>(args[0])->getVal();
-    CurlCallbackData cbdata(loc, vm, as<VarCurl>(args[0]));
-    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &cbdata);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &cbdata);
-    return vm.makeVar<VarInt>(loc, curl_easy_perform(curl));
+    CURLU *dup = curl_url_dup(as<VarCurlUrl>(args[0])->getVal());
+    if(!dup) {
+        vm.fail(loc, "failed to run curl_url_dup()");
+        return nullptr;
+    }
+    return vm.makeVar<VarCurlUrl>(loc, dup);
 }
 
-FERAL_FUNC(feralCurlEasyStrErrFromInt, 1, false,
-           "  fn(errCode) -> Str\n"
-           "Returns the string representation of the error code `errCode`.")
+FERAL_FUNC(feralCurlMultiInit, 0, false,
+           "  fn() -> CurlMulti\n"
+           "Creates and returns a CurlMulti instance which can be used to perform multiple network "
+           "operations concurrently, on the same thread.")
 {
-    EXPECT(VarInt, args[1], "error code");
-    CURLcode code = (CURLcode)as<VarInt>(args[1])->getVal();
-    return vm.makeVar<VarStr>(loc, curl_easy_strerror(code));
+    CURLM *multi = curl_multi_init();
+    if(!multi) {
+        vm.fail(loc, "failed to run curl_multi_init()");
+        return nullptr;
+    }
+    return vm.makeVar<VarCurlMulti>(loc, multi);
 }
 
-FERAL_FUNC(feralCurlSetProgressCBTick, 1, false, "")
+FERAL_FUNC(feralCurlMultiStrErrFromInt, 1, false,
+           "  fn(errCode) -> Str\n"
+           "Returns the string representation of the multi error code `errCode`.")
 {
-    EXPECT(VarInt, args[1], "tick count");
-    VarCurl *curl = as<VarCurl>(args[0]);
-    curl->setProgIntervalTickMax(as<VarInt>(args[1])->getVal());
-    return vm.getNil();
+    EXPECT(VarInt, args[1], "error code");
+    CURLMcode code = (CURLMcode)as<VarInt>(args[1])->getVal();
+    return vm.makeVar<VarStr>(loc, curl_multi_strerror(code));
 }
 
-FERAL_FUNC(feralCurlEasyGetInfoNative, 2, false,
-           "  var.fn(option, suboption) -> Int\n"
-           "Gets the info for the Curl `option` in the curl object `var`, possibly with a "
-           "`suboption`, and returns it as an integer.")
+FERAL_FUNC(feralCurlMultiSetOptNative, 2, false,
+           "  var.fn(option, value) -> Int\n"
+           "Sets the `option` (MOPT_*) in CurlMulti `var` to `value` and returns the CURLMcode.\n"
+           "With MOPT_PIPELINING set to PIPE_MULTIPLEX (the default since libcurl 7.62.0), HTTP/2 "
+           "transfers to the same origin share one connection as separate streams - combine it "
+           "with OPT_PIPEWAIT on the easy handles to make them wait for that connection instead "
+           "of opening new ones.")
 {
-    EXPECT(VarInt, args[1], "option type (CURL_OPT_*)");
-    CURL *curl = as<VarCurl>(args[0])->getVal();
-    int opt    = as<VarInt>(args[1])->getVal();
-    Var *arg   = args[2];
+    EXPECT(VarInt, args[1], "option type (CURL_MOPT_*)");
+    CURLM *multi = as<VarCurlMulti>(args[0])->getVal();
+    int opt      = as<VarInt>(args[1])->getVal();
+    Var *arg     = args[2];
 
-    int res = CURLE_OK;
-    // manually handle each of the options and work accordingly
+    CURLMcode res = CURLM_OK;
     switch(opt) {
-    case CURLINFO_ACTIVESOCKET: {
+    case CURLMOPT_PIPELINING:           // fallthrough
+    case CURLMOPT_MAXCONNECTS:          // fallthrough
+    case CURLMOPT_MAX_HOST_CONNECTIONS: // fallthrough
+#if CURL_AT_LEAST_VERSION(7, 67, 0)
+    case CURLMOPT_MAX_CONCURRENT_STREAMS: // fallthrough
+#endif
+    case CURLMOPT_MAX_TOTAL_CONNECTIONS: {
         EXPECT(VarInt, arg, "option value");
-        long sockfd;
-        res = curl_easy_getinfo(curl, (CURLINFO)opt, &sockfd);
-        as<VarInt>(arg)->setVal(sockfd);
+        res = curl_multi_setopt(multi, (CURLMoption)opt, (long)as<VarInt>(arg)->getVal());
         break;
     }
     default: {
@@ -274,100 +4725,179 @@ FERAL_FUNC(feralCurlEasyGetInfoNative, 2, false,
     return vm.makeVar<VarInt>(loc, res);
 }
 
-FERAL_FUNC(feralCurlEasySetOptNative, 2, true,
-           "  var.fn(option, suboption/value...) -> Int\n"
-           "Sets the `option` in Curl `var` as with one/more `suboption/value` and returns the "
-           "integer result.\n"
-           "Here, type and count of `suboption/value` are dependent on the `option` being used.")
+FERAL_FUNC(feralCurlMultiAdd, 1, false,
+           "  var.fn(curl) -> Int\n"
+           "Adds the Curl (Easy) `curl` to the CurlMulti `var` and returns the CURLMcode.\n"
+           "A Curl can only be in one CurlMulti at a time (CURLM_ADDED_ALREADY is returned "
+           "otherwise), and cannot be performed, reset, cloned, or released to a pool while in "
+           "it.")
 {
-    EXPECT(VarInt, args[1], "option type (CURL_OPT_*)");
-    VarCurl *varCurl = as<VarCurl>(args[0]);
-    CURL *curl       = varCurl->getVal();
-    int opt          = as<VarInt>(args[1])->getVal();
-    Var *arg         = args[2];
+    EXPECT(VarCurl, args[1], "curl easy handle");
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    if(!checkNotAsyncBusy(vm, loc, as<VarCurl>(args[1]))) return nullptr;
+    if(as<VarCurl>(args[1])->getCache()) {
+        vm.fail(loc, "cannot add a curl handle with a cache to a multi handle,"
+                     " use perform() instead");
+        return nullptr;
+    }
+    return vm.makeVar<VarInt>(loc, multi->addHandle(vm, loc, as<VarCurl>(args[1])));
+}
 
-    int res = CURLE_OK;
-    // manually handle each of the options and work accordingly
-    switch(opt) {
-    case CURLOPT_CONNECT_ONLY:   // fallthrough
-    case CURLOPT_FOLLOWLOCATION: // fallthrough
-    case CURLOPT_NOPROGRESS:     // fallthrough
-    case CURLOPT_VERBOSE: {
-        EXPECT(VarInt, arg, "option value");
-        res = curl_easy_setopt(curl, (CURLoption)opt, as<VarInt>(arg)->getVal());
-        break;
+FERAL_FUNC(feralCurlMultiRemove, 1, false,
+           "  var.fn(curl) -> Int\n"
+           "Removes the Curl (Easy) `curl` from the CurlMulti `var` and returns the CURLMcode.")
+{
+    EXPECT(VarCurl, args[1], "curl easy handle");
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    return vm.makeVar<VarInt>(loc, multi->removeHandle(vm, as<VarCurl>(args[1])));
+}
+
+FERAL_FUNC(feralCurlMultiPerform, 0, false,
+           "  var.fn() -> Int\n"
+           "Performs all the pending work of the transfers in the CurlMulti `var`, without "
+           "waiting, and returns the number of transfers that are still running.")
+{
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    multi->setCallbackLoc(loc);
+    multi->resumeRateLimited();
+    int running   = 0;
+    CURLMcode res = curl_multi_perform(multi->getVal(), &running);
+    if(res != CURLM_OK) {
+        vm.fail(loc, "curl_multi_perform() failed: ", curl_multi_strerror(res));
+        return nullptr;
     }
-    case CURLOPT_POSTFIELDS: {
-        // We don't want POSTFIELDS as it doesn't copy the string data to curl,
-        // which is annoying to deal with.
-        opt = CURLOPT_COPYPOSTFIELDS;
+    return vm.makeVar<VarInt>(loc, running);
+}
+
+FERAL_FUNC(feralCurlMultiPoll, 1, false,
+           "  var.fn(timeoutMs) -> Int\n"
+           "Waits for up to `timeoutMs` milliseconds for activity on any of the transfers in the "
+           "CurlMulti `var` and returns the number of file descriptors on which there was "
+           "activity.")
+{
+    EXPECT(VarInt, args[1], "timeout in milliseconds");
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    int timeout         = as<VarInt>(args[1])->getVal();
+    int numfds          = 0;
+    // the sockets of the handles paused by their rate limit are not polled, so perform() must be
+    // called again in time to resume them
+    long rateMs = multi->getRateWaitMs();
+    if(rateMs >= 0 && rateMs < timeout) timeout = rateMs;
+#if CURL_AT_LEAST_VERSION(7, 66, 0)
+    CURLMcode res = curl_multi_poll(multi->getVal(), nullptr, 0, timeout, &numfds);
+#else
+    CURLMcode res = curl_multi_wait(multi->getVal(), nullptr, 0, timeout, &numfds);
+#endif
+    if(res != CURLM_OK) {
+        vm.fail(loc, "failed to poll multi handle: ", curl_multi_strerror(res));
+        return nullptr;
     }
-    case CURLOPT_URL:
-    case CURLOPT_USERAGENT:
-    case CURLOPT_CUSTOMREQUEST:
-    case CURLOPT_COPYPOSTFIELDS: {
-        EXPECT(VarStr, arg, "option value");
-        res = curl_easy_setopt(curl, (CURLoption)opt, as<VarStr>(arg)->getVal().c_str());
-        break;
+    return vm.makeVar<VarInt>(loc, numfds);
+}
+
+FERAL_FUNC(feralCurlMultiWaitEvents, 1, false,
+           "  var.fn(timeoutMs) -> Int\n"
+           "Waits for up to `timeoutMs` milliseconds (forever if negative) for activity on the "
+           "sockets of the transfers in the CurlMulti `var` (or for its timer), services only the "
+           "active sockets, and returns the number of transfers that are still running.\n"
+           "Uses epoll on Linux (poll elsewhere), which scales to a very large number of mostly "
+           "idle connections, unlike `perform()` + `poll()`. Do not mix the two on one CurlMulti.")
+{
+    EXPECT(VarInt, args[1], "timeout in milliseconds");
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    multi->setCallbackLoc(loc);
+    const char *errMsg = nullptr;
+    CURLMcode res      = multi->waitEvents(as<VarInt>(args[1])->getVal(), errMsg);
+    if(errMsg) {
+        vm.fail(loc, "failed to wait for socket events: ", errMsg);
+        return nullptr;
     }
-    case CURLOPT_MIMEPOST: {
-        EXPECT(VarMap, arg, "name-data pairs");
-        curl_mime *mime = varCurl->createMime(vm, loc, as<VarMap>(arg));
-        if(!mime) {
-            vm.fail(loc, "failed to create mime from the given map (possibly empty map)");
-            return nullptr;
-        }
-        res = curl_easy_setopt(curl, (CURLoption)opt, mime);
-        break;
+    if(res != CURLM_OK) {
+        vm.fail(loc, "curl_multi_socket_action() failed: ", curl_multi_strerror(res));
+        return nullptr;
     }
-    case CURLOPT_XFERINFOFUNCTION: {
-        if(arg->is<VarNil>()) {
-            varCurl->setProgressCB(vm, nullptr, {});
-            break;
-        }
-        EXPECT(VarFn, arg, "xfer info function");
-        VarFn *f = as<VarFn>(arg);
-        if(f->getParamCount() < 4) {
-            vm.fail(loc, "expected function to have at least 4",
-                    " parameters for this option, found: ", f->getParamCount());
-            return nullptr;
-        }
-        Span<Var *> cbArgs{args.begin() + 3, args.end()};
-        varCurl->setProgressCB(vm, f, cbArgs);
-        break;
+    return vm.makeVar<VarInt>(loc, multi->getRunning());
+}
+
+FERAL_FUNC(feralCurlMultiSockets, 0, false,
+           "  var.fn() -> Vec<Map>\n"
+           "Returns the sockets which the transfers in the CurlMulti `var` are waiting on, each as "
+           "a map of the socket `fd` and the `events` (POLL_IN/POLL_OUT/POLL_INOUT) to wait for.\n"
+           "Along with `timeout()` and `socketAction()`, this lets an event loop in Feral drive "
+           "the transfers.")
+{
+    auto &sockets = as<VarCurlMulti>(args[0])->getSockets();
+    VarVec *res   = vm.makeVar<VarVec>(loc, sockets.size(), false);
+    for(auto &sock : sockets) {
+        VarMap *item = vm.makeVar<VarMap>(loc, 2, false);
+        item->insert(vm, "fd", vm.makeVar<VarInt>(loc, (int64_t)sock.first), true);
+        item->insert(vm, "events", vm.makeVar<VarInt>(loc, sock.second), true);
+        res->push(vm, item, true);
     }
-    case CURLOPT_WRITEFUNCTION: {
-        if(arg->is<VarNil>()) {
-            varCurl->setWriteCB(vm, nullptr, {});
-            break;
-        }
-        EXPECT(VarFn, arg, "write function");
-        VarFn *f = as<VarFn>(arg);
-        if(f->getParamCount() < 1) {
-            vm.fail(loc, "expected function to have at least 1",
-                    " parameter for this option, found: ", f->getParamCount());
-            return nullptr;
-        }
-        Span<Var *> cbArgs{args.begin() + 3, args.end()};
-        varCurl->setWriteCB(vm, f, cbArgs);
-        break;
+    return res;
+}
+
+FERAL_FUNC(feralCurlMultiTimeout, 0, false,
+           "  var.fn() -> Int\n"
+           "Returns the milliseconds after which `socketAction(SOCKET_TIMEOUT, 0)` must be called "
+           "on the CurlMulti `var`, or -1 if there is no timeout.")
+{
+    return vm.makeVar<VarInt>(loc, as<VarCurlMulti>(args[0])->getTimeoutMs());
+}
+
+FERAL_FUNC(feralCurlMultiSocketAction, 2, false,
+           "  var.fn(fd, events) -> Int\n"
+           "Services the socket `fd` of the CurlMulti `var` on which `events` (CSELECT_*) "
+           "occurred, or its timeout if `fd` is SOCKET_TIMEOUT, and returns the number of "
+           "transfers that are still running.")
+{
+    EXPECT(VarInt, args[1], "socket file descriptor");
+    EXPECT(VarInt, args[2], "socket events (CSELECT_*)");
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    multi->setCallbackLoc(loc);
+    int64_t fd         = as<VarInt>(args[1])->getVal();
+    curl_socket_t sock = fd < 0 ? CURL_SOCKET_TIMEOUT : (curl_socket_t)fd;
+    CURLMcode res      = multi->socketAction(sock, as<VarInt>(args[2])->getVal());
+    if(res != CURLM_OK) {
+        vm.fail(loc, "curl_multi_socket_action() failed: ", curl_multi_strerror(res));
+        return nullptr;
     }
-    case CURLOPT_HTTPHEADER: {
-        EXPECT(VarMap, arg, "name-data pairs");
-        curl_slist *lst = varCurl->createSList(vm, loc, as<VarMap>(arg));
-        if(!lst) {
-            vm.fail(loc, "failed to create slist from the given map (possibly empty map)");
+    return vm.makeVar<VarInt>(loc, multi->getRunning());
+}
+
+FERAL_FUNC(feralCurlMultiReadInfo, 0, false,
+           "  var.fn() -> Vec<Map>\n"
+           "Returns the transfers in the CurlMulti `var` that have finished since the last call, "
+           "each as a map containing the Curl `handle` and its CURLcode `result`.\n"
+           "The finished Curl handles are removed from `var`, so they can be reused.\n"
+           "Fails if the Feral write callback fails while flushing a finished transfer, whose "
+           "handle is removed as well - the transfers already read by this call are lost then, "
+           "while the ones not read yet are returned by the next call.")
+{
+    VarCurlMulti *multi = as<VarCurlMulti>(args[0]);
+    VarVec *res         = vm.makeVar<VarVec>(loc, 0, false);
+    CURLMsg *msg        = nullptr;
+    int msgsLeft        = 0;
+    while((msg = curl_multi_info_read(multi->getVal(), &msgsLeft))) {
+        if(msg->msg != CURLMSG_DONE) continue;
+        CurlCallbackData *cbdata = nullptr;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&cbdata);
+        VarCurl *curl = cbdata->curl;
+        recordTransferStats(msg->easy_handle, msg->data.result);
+        if(!curl->finishTransfer(vm, loc)) {
+            // the rest of the messages stay queued, as they are read one at a time
+            multi->removeHandle(vm, curl);
+            vm.decVarRef(res);
             return nullptr;
         }
-        res = curl_easy_setopt(curl, (CURLoption)opt, lst);
-        break;
+        VarMap *item = vm.makeVar<VarMap>(loc, 2, false);
+        item->insert(vm, "handle", curl, true);
+        item->insert(vm, "result", vm.makeVar<VarInt>(loc, msg->data.result), true);
+        res->push(vm, item, true);
+        // cbdata is freed by this
+        multi->removeHandle(vm, curl);
     }
-    default: {
-        vm.fail(loc, "operation is not yet implemented");
-        return nullptr;
-    }
-    }
-    return vm.makeVar<VarInt>(loc, res);
+    return res;
 }
 
 INIT_DLL(Curl)
@@ -376,22 +4906,99 @@ INIT_DLL(Curl)
 
     // Register the type names
     vm.addLocalType<VarCurl>(loc, "Curl", "The Curl C library's type representation.");
+    vm.addLocalType<VarCurlFuture>(loc, "CurlFuture",
+                                   "The result of an asynchronous Curl transfer.");
+    vm.addLocalType<VarCurlSList>(loc, "CurlSList", "A prebuilt list of strings.");
+    vm.addLocalType<VarCurlUrl>(loc, "CurlUrl", "A parsed URL, used by Curl handles as is.");
+    vm.addLocalType<VarCurlPool>(loc, "CurlPool", "A pool of reusable Curl (Easy) handles.");
+    vm.addLocalType<VarCurlShare>(loc, "CurlShare",
+                                  "The Curl C library's share handle type representation.");
+    vm.addLocalType<VarCurlRateLimit>(loc, "CurlRateLimit",
+                                      "A transfer rate limit shared by Curl handles.");
+    vm.addLocalType<VarCurlCache>(loc, "CurlCache", "An HTTP response cache on disk.");
+    vm.addLocalType<VarCurlMulti>(loc, "CurlMulti",
+                                  "The Curl C library's multi handle type representation.");
 
     vm.addLocal(loc, "globalTrace", feralCurlGlobalTrace);
     vm.addLocal(loc, "strerr", feralCurlEasyStrErrFromInt);
+    vm.addLocal(loc, "stats", feralCurlStats);
+    vm.addLocal(loc, "resetStats", feralCurlResetStats);
+    vm.addLocal(loc, "fetchAllNative", feralCurlFetchAll);
+    vm.addLocal(loc, "downloadSegmentedNative", feralCurlDownloadSegmented);
+    vm.addLocal(loc, "prewarmNative", feralCurlPrewarm);
     vm.addLocal(loc, "newEasy", feralCurlEasyInit);
+    vm.addLocal(loc, "newSList", feralCurlSListInit);
+    vm.addLocal(loc, "newUrlNative", feralCurlUrlInit);
+    vm.addLocal(loc, "urlStrerr", feralCurlUrlStrErrFromInt);
+    vm.addLocal(loc, "newPoolNative", feralCurlPoolInit);
+    vm.addLocal(loc, "newShare", feralCurlShareInit);
+    vm.addLocal(loc, "newRateLimitNative", feralCurlRateLimitInit);
+    vm.addLocal(loc, "newCacheNative", feralCurlCacheInit);
+    vm.addLocal(loc, "shareStrerr", feralCurlShareStrErrFromInt);
+    vm.addLocal(loc, "newMulti", feralCurlMultiInit);
+    vm.addLocal(loc, "multiStrerr", feralCurlMultiStrErrFromInt);
 
     vm.addTypeFn<VarCurl>(loc, "getInfoNative", feralCurlEasyGetInfoNative);
+    vm.addTypeFn<VarCurl>(loc, "getMetrics", feralCurlEasyGetMetrics);
     vm.addTypeFn<VarCurl>(loc, "setOptNative", feralCurlEasySetOptNative);
+    vm.addTypeFn<VarCurl>(loc, "setOpts", feralCurlEasySetOpts);
     vm.addTypeFn<VarCurl>(loc, "perform", feralCurlEasyPerform);
-    vm.addTypeFn<VarCurl>(loc, "setProgressCBTickNative", feralCurlSetProgressCBTick);
+    vm.addTypeFn<VarCurl>(loc, "performAsync", feralCurlEasyPerformAsync);
+    vm.addTypeFn<VarCurl>(loc, "performJson", feralCurlEasyPerformJson);
+    vm.addTypeFn<VarCurl>(loc, "reset", feralCurlEasyReset);
+    vm.addTypeFn<VarCurl>(loc, "clone", feralCurlEasyClone);
+    vm.addTypeFn<VarCurl>(loc, "setProgressIntervalNative", feralCurlSetProgressInterval);
+    vm.addTypeFn<VarCurl>(loc, "setBufferedNative", feralCurlSetBuffered);
+    vm.addTypeFn<VarCurl>(loc, "setWriteCoalesceNative", feralCurlSetWriteCoalesce);
+    vm.addTypeFn<VarCurl>(loc, "takeBuffer", feralCurlTakeBuffer);
+    vm.addTypeFn<VarCurl>(loc, "setJsonResponseNative", feralCurlSetJson);
+    vm.addTypeFn<VarCurl>(loc, "takeJson", feralCurlTakeJson);
+    vm.addTypeFn<VarCurl>(loc, "getHeaders", feralCurlGetHeaders);
+    vm.addTypeFn<VarCurl>(loc, "getHeader", feralCurlGetHeader);
+    vm.addTypeFn<VarCurl>(loc, "setRateLimitNative", feralCurlEasySetRateLimit);
+    vm.addTypeFn<VarCurl>(loc, "setCache", feralCurlEasySetCache);
+    vm.addTypeFn<VarCurl>(loc, "getCacheStatus", feralCurlEasyGetCacheStatus);
+
+    vm.addTypeFn<VarCurlFuture>(loc, "waitNative", feralCurlFutureWait);
+    vm.addTypeFn<VarCurlFuture>(loc, "isDone", feralCurlFutureIsDone);
+
+    vm.addTypeFn<VarCurlUrl>(loc, "getPartNative", feralCurlUrlGetPartNative);
+    vm.addTypeFn<VarCurlUrl>(loc, "setPartNative", feralCurlUrlSetPartNative);
+    vm.addTypeFn<VarCurlUrl>(loc, "appendQuery", feralCurlUrlAppendQuery);
+    vm.addTypeFn<VarCurlUrl>(loc, "str", feralCurlUrlStr);
+    vm.addTypeFn<VarCurlUrl>(loc, "clone", feralCurlUrlClone);
+
+    vm.addTypeFn<VarCurlPool>(loc, "acquire", feralCurlPoolAcquire);
+    vm.addTypeFn<VarCurlPool>(loc, "release", feralCurlPoolRelease);
+
+    vm.addTypeFn<VarCurlShare>(loc, "setOptNative", feralCurlShareSetOptNative);
+
+    vm.addTypeFn<VarCurlRateLimit>(loc, "setRateNative", feralCurlRateLimitSetRate);
+    vm.addTypeFn<VarCurlRateLimit>(loc, "getRate", feralCurlRateLimitGetRate);
+
+    vm.addTypeFn<VarCurlCache>(loc, "prune", feralCurlCachePrune);
+
+    vm.addTypeFn<VarCurlMulti>(loc, "setOptNative", feralCurlMultiSetOptNative);
+    vm.addTypeFn<VarCurlMulti>(loc, "add", feralCurlMultiAdd);
+    vm.addTypeFn<VarCurlMulti>(loc, "remove", feralCurlMultiRemove);
+    vm.addTypeFn<VarCurlMulti>(loc, "perform", feralCurlMultiPerform);
+    vm.addTypeFn<VarCurlMulti>(loc, "pollNative", feralCurlMultiPoll);
+    vm.addTypeFn<VarCurlMulti>(loc, "waitEventsNative", feralCurlMultiWaitEvents);
+    vm.addTypeFn<VarCurlMulti>(loc, "sockets", feralCurlMultiSockets);
+    vm.addTypeFn<VarCurlMulti>(loc, "timeout", feralCurlMultiTimeout);
+    vm.addTypeFn<VarCurlMulti>(loc, "socketAction", feralCurlMultiSocketAction);
+    vm.addTypeFn<VarCurlMulti>(loc, "readInfo", feralCurlMultiReadInfo);
 
     setEnumVars(vm, loc);
 
     return true;
 }
 
-DEINIT_DLL(Curl) { curl_global_cleanup(); }
+DEINIT_DLL(Curl)
+{
+    curlWorkerPool.stop();
+    curl_global_cleanup();
+}
 
 void setEnumVars(VirtualMachine &vm, ModuleLoc loc)
 {
@@ -540,6 +5147,62 @@ void setEnumVars(VirtualMachine &vm, ModuleLoc loc)
     vm.makeLocal<VarInt>(loc, "SHE_NOMEM", "", CURLSHE_NOMEM);
     vm.makeLocal<VarInt>(loc, "SHE_NOT_BUILT_IN", "", CURLSHE_NOT_BUILT_IN);
 
+    // CURLSHoption
+    vm.makeLocal<VarInt>(loc, "SHOPT_SHARE", "", CURLSHOPT_SHARE);
+    vm.makeLocal<VarInt>(loc, "SHOPT_UNSHARE", "", CURLSHOPT_UNSHARE);
+
+    // curl_lock_data
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_COOKIE", "", CURL_LOCK_DATA_COOKIE);
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_DNS", "", CURL_LOCK_DATA_DNS);
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_SSL_SESSION", "", CURL_LOCK_DATA_SSL_SESSION);
+#if CURL_AT_LEAST_VERSION(7, 57, 0)
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_CONNECT", "", CURL_LOCK_DATA_CONNECT);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 61, 0)
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_PSL", "", CURL_LOCK_DATA_PSL);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 88, 0)
+    vm.makeLocal<VarInt>(loc, "LOCK_DATA_HSTS", "", CURL_LOCK_DATA_HSTS);
+#endif
+
+    // CURLMoption
+    vm.makeLocal<VarInt>(loc, "MOPT_PIPELINING", "", CURLMOPT_PIPELINING);
+    vm.makeLocal<VarInt>(loc, "MOPT_MAXCONNECTS", "", CURLMOPT_MAXCONNECTS);
+    vm.makeLocal<VarInt>(loc, "MOPT_MAX_HOST_CONNECTIONS", "", CURLMOPT_MAX_HOST_CONNECTIONS);
+    vm.makeLocal<VarInt>(loc, "MOPT_MAX_TOTAL_CONNECTIONS", "", CURLMOPT_MAX_TOTAL_CONNECTIONS);
+#if CURL_AT_LEAST_VERSION(7, 67, 0)
+    vm.makeLocal<VarInt>(loc, "MOPT_MAX_CONCURRENT_STREAMS", "", CURLMOPT_MAX_CONCURRENT_STREAMS);
+#endif
+
+    // CURL_POLL_*, CURL_CSELECT_*
+    vm.makeLocal<VarInt>(loc, "POLL_NONE", "", CURL_POLL_NONE);
+    vm.makeLocal<VarInt>(loc, "POLL_IN", "", CURL_POLL_IN);
+    vm.makeLocal<VarInt>(loc, "POLL_OUT", "", CURL_POLL_OUT);
+    vm.makeLocal<VarInt>(loc, "POLL_INOUT", "", CURL_POLL_INOUT);
+    vm.makeLocal<VarInt>(loc, "CSELECT_IN", "", CURL_CSELECT_IN);
+    vm.makeLocal<VarInt>(loc, "CSELECT_OUT", "", CURL_CSELECT_OUT);
+    vm.makeLocal<VarInt>(loc, "CSELECT_ERR", "", CURL_CSELECT_ERR);
+    vm.makeLocal<VarInt>(loc, "SOCKET_TIMEOUT", "", -1);
+
+    // CURLPIPE_*
+    vm.makeLocal<VarInt>(loc, "PIPE_NOTHING", "", CURLPIPE_NOTHING);
+    vm.makeLocal<VarInt>(loc, "PIPE_MULTIPLEX", "", CURLPIPE_MULTIPLEX);
+
+    // CURL_HTTP_VERSION_*
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_NONE", "", CURL_HTTP_VERSION_NONE);
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_1_0", "", CURL_HTTP_VERSION_1_0);
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_1_1", "", CURL_HTTP_VERSION_1_1);
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_2_0", "", CURL_HTTP_VERSION_2_0);
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_2TLS", "", CURL_HTTP_VERSION_2TLS);
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_2_PRIOR_KNOWLEDGE", "",
+                         CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+#if CURL_AT_LEAST_VERSION(7, 66, 0)
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_3", "", CURL_HTTP_VERSION_3);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 88, 0)
+    vm.makeLocal<VarInt>(loc, "HTTP_VERSION_3ONLY", "", CURL_HTTP_VERSION_3ONLY);
+#endif
+
 #if CURL_AT_LEAST_VERSION(7, 62, 0)
     // CURLUcode
     vm.makeLocal<VarInt>(loc, "UE_OK", "", CURLUE_OK);
@@ -560,6 +5223,53 @@ void setEnumVars(VirtualMachine &vm, ModuleLoc loc)
     vm.makeLocal<VarInt>(loc, "UE_NO_PORT", "", CURLUE_NO_PORT);
     vm.makeLocal<VarInt>(loc, "UE_NO_QUERY", "", CURLUE_NO_QUERY);
     vm.makeLocal<VarInt>(loc, "UE_NO_FRAGMENT", "", CURLUE_NO_FRAGMENT);
+#if CURL_AT_LEAST_VERSION(7, 81, 0)
+    vm.makeLocal<VarInt>(loc, "UE_NO_ZONEID", "", CURLUE_NO_ZONEID);
+    vm.makeLocal<VarInt>(loc, "UE_BAD_QUERY", "", CURLUE_BAD_QUERY);
+#endif
+
+    vm.makeLocal<VarInt>(loc, "UPART_URL", "", CURLUPART_URL);
+    vm.makeLocal<VarInt>(loc, "UPART_SCHEME", "", CURLUPART_SCHEME);
+    vm.makeLocal<VarInt>(loc, "UPART_USER", "", CURLUPART_USER);
+    vm.makeLocal<VarInt>(loc, "UPART_PASSWORD", "", CURLUPART_PASSWORD);
+    vm.makeLocal<VarInt>(loc, "UPART_OPTIONS", "", CURLUPART_OPTIONS);
+    vm.makeLocal<VarInt>(loc, "UPART_HOST", "", CURLUPART_HOST);
+    vm.makeLocal<VarInt>(loc, "UPART_PORT", "", CURLUPART_PORT);
+    vm.makeLocal<VarInt>(loc, "UPART_PATH", "", CURLUPART_PATH);
+    vm.makeLocal<VarInt>(loc, "UPART_QUERY", "", CURLUPART_QUERY);
+    vm.makeLocal<VarInt>(loc, "UPART_FRAGMENT", "", CURLUPART_FRAGMENT);
+#if CURL_AT_LEAST_VERSION(7, 65, 0)
+    vm.makeLocal<VarInt>(loc, "UPART_ZONEID", "", CURLUPART_ZONEID);
+#endif
+
+    vm.makeLocal<VarInt>(loc, "U_DEFAULT_PORT", "", CURLU_DEFAULT_PORT);
+    vm.makeLocal<VarInt>(loc, "U_NO_DEFAULT_PORT", "", CURLU_NO_DEFAULT_PORT);
+    vm.makeLocal<VarInt>(loc, "U_DEFAULT_SCHEME", "", CURLU_DEFAULT_SCHEME);
+    vm.makeLocal<VarInt>(loc, "U_NON_SUPPORT_SCHEME", "", CURLU_NON_SUPPORT_SCHEME);
+    vm.makeLocal<VarInt>(loc, "U_PATH_AS_IS", "", CURLU_PATH_AS_IS);
+    vm.makeLocal<VarInt>(loc, "U_DISALLOW_USER", "", CURLU_DISALLOW_USER);
+    vm.makeLocal<VarInt>(loc, "U_URLDECODE", "", CURLU_URLDECODE);
+    vm.makeLocal<VarInt>(loc, "U_URLENCODE", "", CURLU_URLENCODE);
+    vm.makeLocal<VarInt>(loc, "U_APPENDQUERY", "", CURLU_APPENDQUERY);
+    vm.makeLocal<VarInt>(loc, "U_GUESS_SCHEME", "", CURLU_GUESS_SCHEME);
+#if CURL_AT_LEAST_VERSION(7, 67, 0)
+    vm.makeLocal<VarInt>(loc, "U_NO_AUTHORITY", "", CURLU_NO_AUTHORITY);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 78, 0)
+    vm.makeLocal<VarInt>(loc, "U_ALLOW_SPACE", "", CURLU_ALLOW_SPACE);
+#endif
+#if CURL_AT_LEAST_VERSION(7, 88, 0)
+    vm.makeLocal<VarInt>(loc, "U_PUNYCODE", "", CURLU_PUNYCODE);
+#endif
+#if CURL_AT_LEAST_VERSION(8, 3, 0)
+    vm.makeLocal<VarInt>(loc, "U_PUNY2IDN", "", CURLU_PUNY2IDN);
+#endif
+#if CURL_AT_LEAST_VERSION(8, 8, 0)
+    vm.makeLocal<VarInt>(loc, "U_GET_EMPTY", "", CURLU_GET_EMPTY);
+#endif
+#if CURL_AT_LEAST_VERSION(8, 9, 0)
+    vm.makeLocal<VarInt>(loc, "U_NO_GUESS_SCHEME", "", CURLU_NO_GUESS_SCHEME);
+#endif
 #endif
 
     // EASY_OPTS
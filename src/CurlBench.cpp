@@ -0,0 +1,350 @@
+// A loopback HTTP/1.1 server and a monotonic clock for bench.fer, so that the binding can be
+// benchmarked offline, with repeatable numbers.
+
+#include <VM/VM.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace fer
+{
+
+// size of the chunks in which the response bodies are sent
+constexpr size_t CURL_BENCH_CHUNK_SIZE = 64 * 1024;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////// Server ////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Serves `GET|HEAD /bytes/<n>` with a body of n bytes (supporting a single `Range: bytes=a-b`),
+// `POST /echo` with the request body, `/status/<code>` with an empty response of that status, and
+// `GET /cache?cc=<Cache-Control>&vary=<header>` with a cacheable response (see serve()), on
+// persistent connections, with a thread per connection. Anything else gets a 404.
+class CurlBenchServer
+{
+    std::mutex mtx;
+    std::thread acceptor;
+    Vector<std::thread> workers;
+    Vector<int> conns;
+    std::atomic<bool> stopping;
+    int listenFd;
+    int port;
+
+    void acceptLoop();
+    void serve(int fd);
+
+public:
+    CurlBenchServer();
+
+    // returns the port being listened on, or -1 (with err set) on failure
+    int start(int reqPort, String &err);
+    void stop();
+};
+
+#if !defined(_WIN32)
+static bool sendAll(int fd, const char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t res = send(fd, data, len, MSG_NOSIGNAL);
+        if(res < 0 && errno == EINTR) continue;
+        if(res <= 0) return false;
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+// returns the value of the header `name` (lowercase, with the colon) in the request head
+static StringRef findHeader(StringRef head, StringRef name)
+{
+    String lower(head);
+    for(auto &c : lower) c = std::tolower((unsigned char)c);
+    size_t pos = lower.find("\r\n" + String(name));
+    if(pos == String::npos) return {};
+    size_t start = head.find_first_not_of(' ', pos + 2 + name.size());
+    size_t end   = head.find("\r\n", start);
+    if(start == StringRef::npos || end == StringRef::npos) return {};
+    return head.substr(start, end - start);
+}
+
+// returns the value of the query parameter `name` (with the equals sign) in the request path
+static StringRef findParam(StringRef path, StringRef name)
+{
+    size_t pos = path.find('?');
+    while(pos != StringRef::npos) {
+        ++pos;
+        if(path.substr(pos).starts_with(name)) {
+            pos += name.size();
+            return path.substr(pos, path.find('&', pos) - pos);
+        }
+        pos = path.find('&', pos);
+    }
+    return {};
+}
+#endif
+
+CurlBenchServer::CurlBenchServer() : stopping(false), listenFd(-1), port(-1) {}
+
+int CurlBenchServer::start(int reqPort, String &err)
+{
+#if defined(_WIN32)
+    err = "the bench server is not supported on Windows";
+    return -1;
+#else
+    if(listenFd >= 0) return port;
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) {
+        err = strerror(errno);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr     = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(reqPort);
+    socklen_t addrLen    = sizeof(addr);
+    if(bind(listenFd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 512) < 0 ||
+       getsockname(listenFd, (sockaddr *)&addr, &addrLen) < 0)
+    {
+        err = strerror(errno);
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+    port     = ntohs(addr.sin_port);
+    stopping = false;
+    acceptor = std::thread(&CurlBenchServer::acceptLoop, this);
+    return port;
+#endif
+}
+
+void CurlBenchServer::stop()
+{
+#if !defined(_WIN32)
+    if(listenFd < 0) return;
+    stopping = true;
+    // unblocks accept() and the reads of the connections
+    shutdown(listenFd, SHUT_RDWR);
+    acceptor.join();
+    close(listenFd);
+    listenFd = -1;
+    Vector<std::thread> toJoin;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for(auto &fd : conns) shutdown(fd, SHUT_RDWR);
+        toJoin.swap(workers);
+    }
+    for(auto &t : toJoin) t.join();
+#endif
+}
+
+void CurlBenchServer::acceptLoop()
+{
+#if !defined(_WIN32)
+    while(!stopping) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::lock_guard<std::mutex> lock(mtx);
+        conns.push_back(fd);
+        workers.emplace_back(&CurlBenchServer::serve, this, fd);
+    }
+#endif
+}
+
+void CurlBenchServer::serve(int fd)
+{
+#if !defined(_WIN32)
+    static const String body(CURL_BENCH_CHUNK_SIZE, 'x');
+    String buf;
+    char readBuf[16 * 1024];
+    bool keepAlive = true;
+    while(keepAlive && !stopping) {
+        size_t headEnd;
+        while((headEnd = buf.find("\r\n\r\n")) == String::npos) {
+            ssize_t res = recv(fd, readBuf, sizeof(readBuf), 0);
+            if(res < 0 && errno == EINTR) continue;
+            if(res <= 0) goto done;
+            buf.append(readBuf, res);
+        }
+        StringRef head(buf.data(), headEnd + 2);
+        bool isHead = head.starts_with("HEAD ");
+        size_t pathStart = head.find(' ') + 1;
+        size_t pathEnd   = head.find(' ', pathStart);
+        StringRef path   = head.substr(pathStart, pathEnd - pathStart);
+        keepAlive        = findHeader(head, "connection:") != "close";
+
+        String resp;
+        if(path == "/echo") {
+            size_t reqLen = std::strtoull(String(findHeader(head, "content-length:")).c_str(),
+                                          nullptr, 10);
+            while(buf.size() < headEnd + 4 + reqLen) {
+                ssize_t res = recv(fd, readBuf, sizeof(readBuf), 0);
+                if(res < 0 && errno == EINTR) continue;
+                if(res <= 0) goto done;
+                buf.append(readBuf, res);
+            }
+            resp = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                   std::to_string(reqLen) + "\r\n\r\n" + buf.substr(headEnd + 4, reqLen);
+            buf.erase(0, headEnd + 4 + reqLen);
+            if(!sendAll(fd, resp.data(), resp.size())) break;
+            continue;
+        }
+        if(path.starts_with("/status/")) {
+            resp = "HTTP/1.1 " + String(path.substr(8)) + " Status\r\n";
+            // 1xx, 204, and 304 responses cannot have a Content-Length
+            if(path[8] != '1' && path.substr(8) != "204" && path.substr(8) != "304") {
+                resp += "Content-Length: 0\r\n";
+            }
+            resp += "\r\n";
+            buf.erase(0, headEnd + 4);
+            if(!sendAll(fd, resp.data(), resp.size())) break;
+            continue;
+        }
+        if(path == "/cache" || path.starts_with("/cache?")) {
+            // the response has the strong validator "v1" and the Cache-Control and Vary from the
+            // query, and its body is the value of the request header named by `vary` ("cached"
+            // without it, or for `*`); a matching If-None-Match gets a 304 instead
+            StringRef cc   = findParam(path, "cc=");
+            StringRef vary = findParam(path, "vary=");
+            String content = "cached";
+            if(!vary.empty() && vary != "*") {
+                String name(vary);
+                for(auto &c : name) c = std::tolower((unsigned char)c);
+                content = findHeader(head, name + ":");
+            }
+            bool notModified = findHeader(head, "if-none-match:") == "\"v1\"";
+            resp = notModified ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n";
+            resp += "ETag: \"v1\"\r\n";
+            if(!cc.empty()) resp += "Cache-Control: " + String(cc) + "\r\n";
+            if(!vary.empty()) resp += "Vary: " + String(vary) + "\r\n";
+            if(!notModified) {
+                resp += "Content-Length: " + std::to_string(content.size()) + "\r\n\r\n" + content;
+            } else {
+                resp += "\r\n";
+            }
+            buf.erase(0, headEnd + 4);
+            if(!sendAll(fd, resp.data(), resp.size())) break;
+            continue;
+        }
+        if(!path.starts_with("/bytes/")) {
+            resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            buf.erase(0, headEnd + 4);
+            if(!sendAll(fd, resp.data(), resp.size())) break;
+            continue;
+        }
+        size_t total = std::strtoull(String(path.substr(7)).c_str(), nullptr, 10);
+        size_t first = 0, last = total ? total - 1 : 0;
+        StringRef range = findHeader(head, "range:");
+        bool partial    = total > 0 && range.starts_with("bytes=");
+        if(partial) {
+            String spec(range.substr(6));
+            size_t dash = spec.find('-');
+            first       = std::strtoull(spec.substr(0, dash).c_str(), nullptr, 10);
+            if(dash != String::npos && dash + 1 < spec.size()) {
+                last = std::min<size_t>(last, std::strtoull(spec.c_str() + dash + 1, nullptr, 10));
+            }
+            if(first > last) {
+                resp = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" +
+                       std::to_string(total) + "\r\nContent-Length: 0\r\n\r\n";
+                buf.erase(0, headEnd + 4);
+                if(!sendAll(fd, resp.data(), resp.size())) break;
+                continue;
+            }
+        }
+        size_t len = total ? last - first + 1 : 0;
+        resp       = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+        resp += "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n";
+        if(partial) {
+            resp += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) +
+                    "/" + std::to_string(total) + "\r\n";
+        }
+        resp += "Content-Length: " + std::to_string(len) + "\r\n\r\n";
+        buf.erase(0, headEnd + 4);
+        if(!sendAll(fd, resp.data(), resp.size())) break;
+        if(isHead) continue;
+        while(len > 0) {
+            size_t n = std::min(len, body.size());
+            if(!sendAll(fd, body.data(), n)) goto done;
+            len -= n;
+        }
+    }
+done:
+    std::lock_guard<std::mutex> lock(mtx);
+    conns.erase(std::find(conns.begin(), conns.end(), fd));
+    close(fd);
+#endif
+}
+
+static CurlBenchServer curlBenchServer;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////// Functions ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+FERAL_FUNC(feralCurlBenchStartServer, 1, false,
+           "  fn(port) -> Int\n"
+           "Starts the loopback HTTP/1.1 bench server on `port` (any free port if 0), and returns "
+           "the port it listens on. It serves `GET`/`HEAD` `/bytes/<n>` with a body of n bytes, "
+           "`POST /echo` with the request body, `/status/<code>` with an empty response of that "
+           "status, and `GET /cache?cc=<Cache-Control>&vary=<header>` with the ETag \"v1\" (a "
+           "matching If-None-Match gets a 304) and the value of the request header `vary` as the "
+           "body, and supports keep-alive and single byte ranges.")
+{
+    EXPECT(VarInt, args[1], "port to listen on");
+    String err;
+    int port = curlBenchServer.start(as<VarInt>(args[1])->getVal(), err);
+    if(port < 0) {
+        vm.fail(loc, "failed to start bench server: ", err);
+        return nullptr;
+    }
+    return vm.makeVar<VarInt>(loc, port);
+}
+
+FERAL_FUNC(feralCurlBenchStopServer, 0, false,
+           "  fn() -> Nil\n"
+           "Stops the loopback HTTP/1.1 bench server, closing all its connections.")
+{
+    curlBenchServer.stop();
+    return vm.getNil();
+}
+
+FERAL_FUNC(feralCurlBenchNowUs, 0, false,
+           "  fn() -> Int\n"
+           "Returns the time of a monotonic clock in microseconds, for measuring intervals.")
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return vm.makeVar<VarInt>(
+        loc, std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+INIT_DLL(CurlBench)
+{
+    vm.addLocal(loc, "startServerNative", feralCurlBenchStartServer);
+    vm.addLocal(loc, "stopServer", feralCurlBenchStopServer);
+    vm.addLocal(loc, "nowUs", feralCurlBenchNowUs);
+    return true;
+}
+
+DEINIT_DLL(CurlBench) { curlBenchServer.stop(); }
+
+} // namespace fer